@@ -0,0 +1,272 @@
+// Throughput and latency benchmark for every allocation policy, with glibc
+// malloc as the baseline.
+//
+// Build: gcc -O2 -o bench bench.c umem.c -lm
+// Usage: ./bench [callsPerWorkload] [initialHeapBytes]
+//
+// Each workload runs twice per allocator with the same random sequence: once
+// untimed for calls per second, once with a clock read around every call for
+// the latency percentiles (which include the clock's own cost, the same for
+// every allocator). Each run gets a fresh explicit heap that may grow, with
+// the default mmap threshold and page release; BUDDY cannot grow, so
+// failures are counted rather than hidden.
+#include "umem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define SLOTS      10000     // Live blocks in the random workloads
+#define QUEUE      4096      // Blocks in flight between producer and consumer
+#define BUFFERS    64        // Buffers grown side by side by the realloc workload
+#define MAX_BUFFER (64 * 1024)
+
+typedef struct {
+    const char *name;
+    int algo;                // 0 for glibc
+} allocator_t;
+
+static const allocator_t allocators[] = {
+    {"glibc", 0},
+    {"BEST_FIT", BEST_FIT},
+    {"WORST_FIT", WORST_FIT},
+    {"FIRST_FIT", FIRST_FIT},
+    {"NEXT_FIT", NEXT_FIT},
+    {"BUDDY", BUDDY},
+    {"TLSF", TLSF},
+};
+
+// State of one run: where the calls go, and where their latencies are kept
+static umem_heap_t *heap;          // NULL for glibc
+static uint32_t *latencies;        // NULL for the untimed run
+static size_t calls;
+static size_t failures;
+static uint64_t rng;
+
+static inline uint64_t nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint64_t nextRandom(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static inline void record(uint64_t start) {
+    if (latencies != NULL) {
+        uint64_t elapsed = nowNs() - start;
+        latencies[calls] = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+    }
+    calls++;
+}
+
+static void *benchAlloc(size_t size) {
+    uint64_t start = latencies ? nowNs() : 0;
+    void *ptr = heap ? umalloc_from(heap, size) : malloc(size);
+    record(start);
+    if (ptr == NULL) {
+        failures++;
+    } else {
+        *(char *)ptr = 1;  // Touch it, so lazily mapped memory is paid for here
+    }
+    return ptr;
+}
+
+static void *benchRealloc(void *ptr, size_t size) {
+    uint64_t start = latencies ? nowNs() : 0;
+    void *moved = heap ? urealloc_from(heap, ptr, size) : realloc(ptr, size);
+    record(start);
+    if (moved == NULL) {
+        failures++;
+        return ptr;  // Still allocated
+    }
+    ((char *)moved)[size - 1] = 1;
+    return moved;
+}
+
+static void benchFree(void *ptr) {
+    if (ptr == NULL) {
+        return;  // A failed allocation; not a call worth timing
+    }
+    uint64_t start = latencies ? nowNs() : 0;
+    if (heap) {
+        ufree_to(heap, ptr);
+    } else {
+        free(ptr);
+    }
+    record(start);
+}
+
+// Uniform small sizes: replace a random live block with one of 16 to 128 bytes
+static void uniformSmall(size_t target) {
+    static void *slots[SLOTS];
+    memset(slots, 0, sizeof(slots));
+    while (calls < target) {
+        size_t i = nextRandom() % SLOTS;
+        benchFree(slots[i]);
+        slots[i] = benchAlloc(16 + nextRandom() % 113);
+    }
+    for (size_t i = 0; i < SLOTS; i++) {
+        benchFree(slots[i]);
+    }
+}
+
+// Power-law sizes: mostly small blocks with a long tail up to 64 KB
+// (Pareto, alpha 1.2, from 16 bytes)
+static void powerLaw(size_t target) {
+    static void *slots[SLOTS];
+    memset(slots, 0, sizeof(slots));
+    while (calls < target) {
+        size_t i = nextRandom() % SLOTS;
+        double u = (nextRandom() >> 11) * (1.0 / 9007199254740992.0) + 1e-12;
+        double size = 16 * pow(u, -1 / 1.2);
+        benchFree(slots[i]);
+        slots[i] = benchAlloc(size < MAX_BUFFER ? (size_t)size : MAX_BUFFER);
+    }
+    for (size_t i = 0; i < SLOTS; i++) {
+        benchFree(slots[i]);
+    }
+}
+
+// Producer/consumer lifetimes: messages are freed in the order they were made,
+// QUEUE calls later, while one in 64 is kept for sixteen times as long
+static void producerConsumer(size_t target) {
+    static void *queue[QUEUE];
+    static void *kept[QUEUE / 4];
+    memset(queue, 0, sizeof(queue));
+    memset(kept, 0, sizeof(kept));
+    size_t head = 0, keptNext = 0;
+    while (calls < target) {
+        void *message = queue[head];
+        if (message != NULL && nextRandom() % 64 == 0) {
+            benchFree(kept[keptNext]);
+            kept[keptNext] = message;
+            keptNext = (keptNext + 1) % (QUEUE / 4);
+        } else {
+            benchFree(message);
+        }
+        queue[head] = benchAlloc(64 + nextRandom() % 960);
+        head = (head + 1) % QUEUE;
+    }
+    for (size_t i = 0; i < QUEUE; i++) {
+        benchFree(queue[i]);
+    }
+    for (size_t i = 0; i < QUEUE / 4; i++) {
+        benchFree(kept[i]);
+    }
+}
+
+// Realloc growth: buffers grow by half again from 16 bytes up to 64 KB, the
+// way a string builder or vector does, and start over once full
+static void reallocGrowth(size_t target) {
+    static void *buffers[BUFFERS];
+    static size_t sizes[BUFFERS];
+    memset(buffers, 0, sizeof(buffers));
+    while (calls < target) {
+        size_t i = nextRandom() % BUFFERS;
+        if (buffers[i] == NULL) {
+            sizes[i] = 16;
+            buffers[i] = benchAlloc(sizes[i]);
+        } else if (sizes[i] >= MAX_BUFFER) {
+            benchFree(buffers[i]);
+            buffers[i] = NULL;
+        } else {
+            sizes[i] += sizes[i] / 2;
+            buffers[i] = benchRealloc(buffers[i], sizes[i]);
+        }
+    }
+    for (size_t i = 0; i < BUFFERS; i++) {
+        benchFree(buffers[i]);
+    }
+}
+
+typedef struct {
+    const char *name;
+    void (*run)(size_t target);
+} workload_t;
+
+static const workload_t workloads[] = {
+    {"Uniform small sizes (16-128 bytes)", uniformSmall},
+    {"Power-law sizes (16 bytes to 64 KB)", powerLaw},
+    {"Producer/consumer lifetimes", producerConsumer},
+    {"Realloc growth (16 bytes to 64 KB)", reallocGrowth},
+};
+
+static int compareLatency(const void *x, const void *y) {
+    uint32_t a = *(const uint32_t *)x, b = *(const uint32_t *)y;
+    return (a > b) - (a < b);
+}
+
+// Run workload once against an allocator; returns the seconds it took
+static double runOnce(const workload_t *workload, const allocator_t *allocator, size_t target,
+                      size_t heapSize, uint32_t *latencyBuffer) {
+    if (allocator->algo != 0) {
+        heap = umem_heap_create(heapSize, allocator->algo, 1);
+        if (heap == NULL) {
+            return -1;
+        }
+        umem_heap_grow(heap, 0);
+    } else {
+        heap = NULL;
+    }
+
+    latencies = latencyBuffer;
+    calls = 0;
+    failures = 0;
+    rng = 0x9E3779B97F4A7C15ULL;
+
+    double start = nowNs() / 1e9;
+    workload->run(target);
+    double elapsed = nowNs() / 1e9 - start;
+
+    if (heap != NULL) {
+        umem_heap_destroy(heap);
+    }
+    return elapsed;
+}
+
+int main(int argc, char **argv) {
+    size_t target = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+    size_t heapSize = argc > 2 ? strtoul(argv[2], NULL, 0) : 64 << 20;
+
+    // The workloads finish with a final round of frees past the target
+    uint32_t *latencyBuffer = malloc((target + 2 * SLOTS) * sizeof(uint32_t));
+    if (latencyBuffer == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+        printf("%s, %zu calls\n", workloads[w].name, target);
+        printf("%-10s %14s %10s %10s %10s %9s\n", "Allocator", "Calls/s", "p50 ns", "p99 ns", "p999 ns", "Failed");
+
+        for (size_t i = 0; i < sizeof(allocators) / sizeof(allocators[0]); i++) {
+            const allocator_t *allocator = &allocators[i];
+            double elapsed = runOnce(&workloads[w], allocator, target, heapSize, NULL);
+            if (elapsed < 0) {
+                printf("%-10s could not create a %zu-byte heap\n", allocator->name, heapSize);
+                continue;
+            }
+            size_t untimedCalls = calls;
+
+            runOnce(&workloads[w], allocator, target, heapSize, latencyBuffer);
+            qsort(latencyBuffer, calls, sizeof(uint32_t), compareLatency);
+
+            printf("%-10s %14.0f %10u %10u %10u %9zu\n", allocator->name,
+                   elapsed > 0 ? untimedCalls / elapsed : 0,
+                   latencyBuffer[calls * 50 / 100],
+                   latencyBuffer[calls * 99 / 100],
+                   latencyBuffer[calls * 999 / 1000],
+                   failures);
+        }
+        printf("\n");
+    }
+
+    free(latencyBuffer);
+    return 0;
+}
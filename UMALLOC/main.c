@@ -1,416 +1,1234 @@
-#include "umem.h"
-#include <stdio.h>
-
-int testFragmentation();
-int testFunctions();
-int testInit();
-int doubleFree();
-int testNextFit();
-int testWorstFit();
-int testFirstFit();
-int testEmpty();
-int testStress();
-
-int main(){
-//testFragmentation();
-//testFunctions();
-//testInit();
-//doubleFree();
-//testNextFit();
-//testWorstFit();
-//testFirstFit();
-//testEmpty();
-testStress();
-}
-
-
-
-int testFunctions() {
-    
-    // Test 1: Initialize memory and test to see if all functions work
-    printf("Test 1: Initializing memory allocator\n");
-    if (umeminit(4096, BEST_FIT) == 0) { // size of heap is 4096 and it is using the best fit algorithm
-        printf("Initialization successful.\n");
-    } else {
-        printf("Initialization failed.\n");
-        return 1;
-    }
-        printf("\n");
-    // Test 2: Allocate a memory block and check if it succeeds
-    
-    printf("Test 2: Allocating a memory block of 1 bytes\n");
-    void *ptr1 = umalloc(1);
-    if (ptr1 != NULL) {
-        printf("Allocation successful. Pointer: %p\n", ptr1);
-        
-    } else {
-        printf("Allocation failed.\n");
-    }
-	    umemstats();
-        printf("\n");
-    
-    // Test 3: Allocate another memory block and check if it succeeds
-    printf("Test 3: Allocating a memory block of 32 bytes\n");
-    void *ptr2 = umalloc(32);
-    if (ptr2 != NULL) {
-        printf("Allocation successful. Pointer: %p\n", ptr2);
-    } else {
-        printf("Allocation failed.\n");
-    }
-    	umemstats();
-        printf("\n");
-
-    // Test 4: Free the first memory block
-    printf("Test 4: Freeing the first memory block\n");
-    if (ufree(ptr1) == 1) {
-        printf("Free successful.\n");
-    } else {
-        printf("Free failed.\n");
-    }
-        umemstats();
-        printf("\n");
-
-     // Test 5: Allocate another memory block and check if it succeeds
-    printf("Test 5: Allocating a memory block of 64 bytes\n");
-    void *ptr5 = umalloc(64);
-    if (ptr5 != NULL) {
-        printf("Allocation successful. Pointer: %p\n", ptr5);
-    } else {
-        printf("Allocation failed.\n");
-    }
-    	umemstats();
-        printf("\n");
-
-    // Test 6: Reallocate a block to a larger size
-    printf("Test 6: Reallocating the second block to 64 bytes\n");
-    void *ptr3 = urealloc(ptr2, 64);
-    if (ptr3 != NULL) {
-        printf("Reallocation successful. New pointer: %p\n", ptr3);
-    } else {
-        printf("Reallocation failed.\n");
-    }
-
-        umemstats();
-        printf("\n");
-
-    // Test 7: Free the reallocated block
-    printf("Test 7: Freeing the reallocated block\n");
-    if (ufree(ptr3) == 1) {
-        printf("Free successful.\n");
-    } else {
-        printf("Free failed.\n");
-    }
-        printf("\n");
-
-    // Test 8: Allocation after multiple operations
-    printf("Test 8: Allocating a large memory block of 128 bytes\n");
-    void *ptr4 = umalloc(128);
-    if (ptr4 != NULL) {
-        printf("Allocation successful. Pointer: %p\n", ptr4);
-    } else {
-        printf("Allocation failed.\n");
-    }
-        printf("\n");
-
-    // Test 9: Print memory statistics
-    printf("Test 9: Printing memory statistics\n");
-    umemstats();
-
-    // Clean up and exit
-    if (ptr4 != NULL) ufree(ptr4);
-
-    printf("All tests completed.\n");
-    return 0;
-   
-}
-
-
-int testFragmentation() { // this tests for fragmentations and the calculations regarding them with BEST_FIT
-    // Test 1: Initialize memory allocator with a valid size and BEST_FIT algorithm
-    printf("Test 1: Initializing memory allocator\n");
-    if (umeminit(1024, BEST_FIT) == 0) { // Initializing a heap of 1024 bytes with BEST_FIT
-        printf("Initialization successful.\n");
-    } else {
-        printf("Initialization failed.\n");
-        return 1;
-    }
-        printf("\n");
-
-    // Test 2: Allocate initial blocks to create some fragmentation
-    printf("Test 2: Allocating blocks to create fragmentation\n");
-    void *ptr1 = umalloc(100);  
-    void *ptr2 = umalloc(200);  
-    void *ptr3 = umalloc(50);   
-    void *ptr4 = umalloc(150);  
-    if (ptr1 && ptr2 && ptr3 && ptr4) {
-        printf("Initial allocations successful.\n");
-    } else {
-        printf("Initial allocation failed.\n");
-        return 1;
-    }
-        printf("\n");
-
-    // Test 3: Free some blocks to create fragmented free list
-    printf("Test 3: Freeing blocks to create fragmentation\n");
-    ufree(ptr1);  // Free 100-byte block
-    ufree(ptr3);  // Free 50-byte block
-        umemstats();
-        printf("\n");
-
-    // Test 4: Allocate a block that should use BEST_FIT to choose the 50-byte free block
-    printf("Test 4: Allocating a 40-byte block (BEST_FIT should pick the 50-byte free block)\n");
-    void *ptr5 = umalloc(40);
-    if (ptr5 != NULL) {
-        printf("Allocation successful. Pointer: %p\n", ptr5);
-    } else {
-        printf("Allocation failed.\n");
-    }
-        umemstats();
-        printf("\n");
-
-    // Test 5: Allocate another block that requires BEST_FIT to pick the 100-byte free block
-    printf("Test 5: Allocating a 90-byte block (BEST_FIT should pick the 100-byte free block)\n");
-    void *ptr6 = umalloc(90);
-    if (ptr6 != NULL) {
-        printf("Allocation successful. Pointer: %p\n", ptr6);
-    } else {
-        printf("Allocation failed.\n");
-    }
-        umemstats();
-        printf("\n");
-
-    // Test 6: Clean up remaining allocations
-    printf("Test 6: Cleaning up allocations\n");
-    ufree(ptr2);
-    ufree(ptr4);
-    ufree(ptr5);
-    ufree(ptr6);
-        umemstats();
-        printf("\n");
-
-    printf("All tests completed.\n");
-    return 0;
-}
-
-int testInit() {
-    
-    
-    printf("Test 1: Initializing memory allocator\n");
-    if (umeminit(4096, BEST_FIT) == 0) { 
-        printf("Initialization successful.\n");
-    } else {
-        printf("Initialization failed.\n");
-        return 1;
-    }
-
-    printf("\n");
-
-    // Test 1: Initialize the memory again to see if the flag works properly
-    printf("Test 2: Attempting to re-initialize memory allocator\n");
-    if (umeminit(8192, WORST_FIT) == 0) {
-        printf("Initialization successful.\n");
-    } else {
-        printf("Already initialized memory\n");
-    }
-
-    return 0; 
-}
-
-int doubleFree(){
-    
-    printf("Initializing memory allocator\n");
-    if (umeminit(4096, BEST_FIT) == 0) { // size of heap is 4096 and it is using the best fit algorithm
-        printf("Initialization successful.\n");
-    } else {
-        printf("Initialization failed.\n");
-        return 1;
-    }
-        printf("\n");
-
-    // Test 1: Allocate another memory block and check if it succeeds
-    printf("Test 1: Allocating a memory block of 64 bytes\n");
-    void *ptr5 = umalloc(64);
-    if (ptr5 != NULL) {
-        printf("Allocation successful. Pointer: %p\n", ptr5);
-    } else {
-        printf("Allocation failed.\n");
-    }
-        
-    	umemstats();
-        printf("\n");
-
-     // Test 2: Free the first memory block
-    printf("Test 2: Freeing the first memory block\n");
-    if (ufree(ptr5) == 1) {
-        printf("Free successful.\n");
-    } else {
-        printf("Free failed.\n");
-    }
-        printf("\n");
-
-    // Test 3: Attempt double-free on the same block (should detect and handle it)
-    printf("Test 3: Attempting double-free on the first memory block\n");
-    if (ufree(ptr5) == 1) {
-        printf("Double-free detected and not handled.\n");
-    }
-        printf("\n");
-    return 0;
-}
-
-int testNextFit() {
-    printf("Initializing memory allocator with NEXT_FIT algorithm\n");
-    if (umeminit(1024, NEXT_FIT) == 0) { // Initialize with 1024 bytes
-        printf("Initialization successful.\n");
-    } else {
-        printf("Initialization failed.\n");
-        return 1;
-    }
-
-    // Allocate multiple blocks to see the "next fit" behavior
-    printf("Allocating 100 bytes\n");
-    void *ptr1 = umalloc(100);
-    printf("Allocating 200 bytes\n");
-    void *ptr2 = umalloc(200);
-    printf("Allocating 50 bytes\n");
-    void *ptr3 = umalloc(50);
-
-    printf("\n");
-    umemstats();
-    printf("\n");
-
-    // Free first block to create space for next fit
-    printf("Freeing 100-byte block\n");
-    ufree(ptr1);
-
-    printf("\n");
-    umemstats();
-    printf("\n");
-
-    // Allocate a block that should use the space freed by ptr1
-    printf("Allocating 90 bytes (Next Fit should select the free 100-byte block)\n");
-    void *ptr4 = umalloc(90);
-
-    if (ptr4) {
-        printf("Allocation successful.\n");
-    } else {
-        printf("Allocation failed.\n");
-    }
-
-    printf("\n");
-    umemstats();
-
-    // Clean up
-    ufree(ptr2);
-    ufree(ptr3);
-    ufree(ptr4);
-
-    return 0;
-}
-int testWorstFit() {
-    printf("Initializing memory allocator with WORST_FIT algorithm\n");
-    if (umeminit(1024, WORST_FIT) == 0) { // Initialize with 1024 bytes
-        printf("Initialization successful.\n");
-    } else {
-        printf("Initialization failed.\n");
-        return 1;
-    }
-
-    // Allocate multiple blocks and then free some to create large gaps
-    printf("Allocating 100 bytes\n");
-    void *ptr1 = umalloc(100);
-    printf("Allocating 200 bytes\n");
-    void *ptr2 = umalloc(200);
-    printf("Allocating 50 bytes\n");
-    void *ptr3 = umalloc(50);
-
-    printf("Freeing 200-byte block\n");
-    ufree(ptr2);
-
-    // Now, we have a large free block of 200 bytes
-    printf("Allocating 80 bytes (Worst Fit should select the 200-byte block)\n");
-    void *ptr4 = umalloc(80);
-
-    if (ptr4) {
-        printf("Allocation successful.\n");
-    } else {
-        printf("Allocation failed.\n");
-    }
-    umemstats();
-
-    // Clean up
-    ufree(ptr1);
-    ufree(ptr3);
-    ufree(ptr4);
-
-    return 0;
-}
-int testFirstFit() {
-    printf("Initializing memory allocator with FIRST_FIT algorithm\n");
-    if (umeminit(1024, FIRST_FIT) == 0) { // Initialize with 1024 bytes
-        printf("Initialization successful.\n");
-    } else {
-        printf("Initialization failed.\n");
-        return 1;
-    }
-
-    // Allocate blocks and then free some to create gaps
-    printf("Allocating 100 bytes\n");
-    void *ptr1 = umalloc(100);
-    printf("Allocating 50 bytes\n");
-    void *ptr2 = umalloc(50);
-    printf("Allocating 200 bytes\n");
-    void *ptr3 = umalloc(200);
-
-    printf("Freeing 100-byte block\n");
-    ufree(ptr1);
-
-    // Attempt to allocate 80 bytes, which should fit into the first free block (100 bytes)
-    printf("Allocating 80 bytes (First Fit should select the 100-byte block)\n");
-    void *ptr4 = umalloc(80);
-
-    if (ptr4) {
-        printf("Allocation successful.\n");
-    } else {
-        printf("Allocation failed.\n");
-    }
-    umemstats();
-
-    // Clean up
-    ufree(ptr2);
-    ufree(ptr3);
-    ufree(ptr4);
-
-    return 0;
-}
-
-int testEmpty(){
-
-    printf("Initializing memory allocator with WORST_FIT algorithm, but 0 Bytes\n");
-    if (umeminit(0, WORST_FIT) == 0) { // Initialize with 1024 bytes
-        printf("Initialization successful.\n");
-    } else {
-        printf("Initialization failed.\n");
-        return 1;
-    }
-    return 0;
-
-}
-int testStress() {
-    printf("Stress Testing with Many Small Allocations\n");
-    umeminit(4096, FIRST_FIT);
-
-    void *pointers[50];
-    for (int i = 0; i < 50; i++) {
-        pointers[i] = umalloc(10);  // Allocate 50 small blocks
-    }
-    umemstats();
-
-    printf("\n");
-    // Free all blocks in reverse order to check stability
-    for (int i = 49; i >= 0; i--) {
-        ufree(pointers[i]);
-    }
-    umemstats();
-    return 0;
-}
-
+#include "umem.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+int testFragmentation();
+int testFunctions();
+int testInit();
+int doubleFree();
+int testNextFit();
+int testWorstFit();
+int testFirstFit();
+int testEmpty();
+int testStress();
+int testBuddy();
+int testTLSF();
+int testArenas();
+int testHeaps();
+int testGrowth();
+int testRelease();
+int testRealloc();
+int testLarge();
+int testPool();
+int testBumpArena();
+int testAligned();
+int testBatch();
+int testSnapshot();
+int testTrace();
+int testHugePages();
+int testCompactHeader();
+int testPersist();
+
+int main(){
+//testFragmentation();
+//testFunctions();
+//testInit();
+//doubleFree();
+//testNextFit();
+//testWorstFit();
+//testFirstFit();
+//testEmpty();
+//testBuddy();
+//testTLSF();
+//testArenas();
+//testHeaps();
+//testGrowth();
+//testRelease();
+//testRealloc();
+//testLarge();
+//testPool();
+//testBumpArena();
+//testAligned();
+//testBatch();
+//testSnapshot();
+//testTrace();
+//testHugePages();
+//testCompactHeader();
+//testPersist();
+testStress();
+}
+
+
+
+int testFunctions() {
+    
+    // Test 1: Initialize memory and test to see if all functions work
+    printf("Test 1: Initializing memory allocator\n");
+    if (umeminit(4096, BEST_FIT) == 0) { // size of heap is 4096 and it is using the best fit algorithm
+        printf("Initialization successful.\n");
+    } else {
+        printf("Initialization failed.\n");
+        return 1;
+    }
+        printf("\n");
+    // Test 2: Allocate a memory block and check if it succeeds
+    
+    printf("Test 2: Allocating a memory block of 1 bytes\n");
+    void *ptr1 = umalloc(1);
+    if (ptr1 != NULL) {
+        printf("Allocation successful. Pointer: %p\n", ptr1);
+        
+    } else {
+        printf("Allocation failed.\n");
+    }
+	    umemstats();
+        printf("\n");
+    
+    // Test 3: Allocate another memory block and check if it succeeds
+    printf("Test 3: Allocating a memory block of 32 bytes\n");
+    void *ptr2 = umalloc(32);
+    if (ptr2 != NULL) {
+        printf("Allocation successful. Pointer: %p\n", ptr2);
+    } else {
+        printf("Allocation failed.\n");
+    }
+    	umemstats();
+        printf("\n");
+
+    // Test 4: Free the first memory block
+    printf("Test 4: Freeing the first memory block\n");
+    if (ufree(ptr1) == 1) {
+        printf("Free successful.\n");
+    } else {
+        printf("Free failed.\n");
+    }
+        umemstats();
+        printf("\n");
+
+     // Test 5: Allocate another memory block and check if it succeeds
+    printf("Test 5: Allocating a memory block of 64 bytes\n");
+    void *ptr5 = umalloc(64);
+    if (ptr5 != NULL) {
+        printf("Allocation successful. Pointer: %p\n", ptr5);
+    } else {
+        printf("Allocation failed.\n");
+    }
+    	umemstats();
+        printf("\n");
+
+    // Test 6: Reallocate a block to a larger size
+    printf("Test 6: Reallocating the second block to 64 bytes\n");
+    void *ptr3 = urealloc(ptr2, 64);
+    if (ptr3 != NULL) {
+        printf("Reallocation successful. New pointer: %p\n", ptr3);
+    } else {
+        printf("Reallocation failed.\n");
+    }
+
+        umemstats();
+        printf("\n");
+
+    // Test 7: Free the reallocated block
+    printf("Test 7: Freeing the reallocated block\n");
+    if (ufree(ptr3) == 1) {
+        printf("Free successful.\n");
+    } else {
+        printf("Free failed.\n");
+    }
+        printf("\n");
+
+    // Test 8: Allocation after multiple operations
+    printf("Test 8: Allocating a large memory block of 128 bytes\n");
+    void *ptr4 = umalloc(128);
+    if (ptr4 != NULL) {
+        printf("Allocation successful. Pointer: %p\n", ptr4);
+    } else {
+        printf("Allocation failed.\n");
+    }
+        printf("\n");
+
+    // Test 9: Print memory statistics
+    printf("Test 9: Printing memory statistics\n");
+    umemstats();
+
+    // Clean up and exit
+    if (ptr4 != NULL) ufree(ptr4);
+
+    printf("All tests completed.\n");
+    return 0;
+   
+}
+
+
+int testFragmentation() { // this tests for fragmentations and the calculations regarding them with BEST_FIT
+    // Test 1: Initialize memory allocator with a valid size and BEST_FIT algorithm
+    printf("Test 1: Initializing memory allocator\n");
+    if (umeminit(1024, BEST_FIT) == 0) { // Initializing a heap of 1024 bytes with BEST_FIT
+        printf("Initialization successful.\n");
+    } else {
+        printf("Initialization failed.\n");
+        return 1;
+    }
+        printf("\n");
+
+    // Test 2: Allocate initial blocks to create some fragmentation
+    printf("Test 2: Allocating blocks to create fragmentation\n");
+    void *ptr1 = umalloc(100);  
+    void *ptr2 = umalloc(200);  
+    void *ptr3 = umalloc(50);   
+    void *ptr4 = umalloc(150);  
+    if (ptr1 && ptr2 && ptr3 && ptr4) {
+        printf("Initial allocations successful.\n");
+    } else {
+        printf("Initial allocation failed.\n");
+        return 1;
+    }
+        printf("\n");
+
+    // Test 3: Free some blocks to create fragmented free list
+    printf("Test 3: Freeing blocks to create fragmentation\n");
+    ufree(ptr1);  // Free 100-byte block
+    ufree(ptr3);  // Free 50-byte block
+        umemstats();
+        printf("\n");
+
+    // Test 4: Allocate a block that should use BEST_FIT to choose the 50-byte free block
+    printf("Test 4: Allocating a 40-byte block (BEST_FIT should pick the 50-byte free block)\n");
+    void *ptr5 = umalloc(40);
+    if (ptr5 != NULL) {
+        printf("Allocation successful. Pointer: %p\n", ptr5);
+    } else {
+        printf("Allocation failed.\n");
+    }
+        umemstats();
+        printf("\n");
+
+    // Test 5: Allocate another block that requires BEST_FIT to pick the 100-byte free block
+    printf("Test 5: Allocating a 90-byte block (BEST_FIT should pick the 100-byte free block)\n");
+    void *ptr6 = umalloc(90);
+    if (ptr6 != NULL) {
+        printf("Allocation successful. Pointer: %p\n", ptr6);
+    } else {
+        printf("Allocation failed.\n");
+    }
+        umemstats();
+        printf("\n");
+
+    // Test 6: Clean up remaining allocations
+    printf("Test 6: Cleaning up allocations\n");
+    ufree(ptr2);
+    ufree(ptr4);
+    ufree(ptr5);
+    ufree(ptr6);
+        umemstats();
+        printf("\n");
+
+    printf("All tests completed.\n");
+    return 0;
+}
+
+int testInit() {
+    
+    
+    printf("Test 1: Initializing memory allocator\n");
+    if (umeminit(4096, BEST_FIT) == 0) { 
+        printf("Initialization successful.\n");
+    } else {
+        printf("Initialization failed.\n");
+        return 1;
+    }
+
+    printf("\n");
+
+    // Test 1: Initialize the memory again to see if the flag works properly
+    printf("Test 2: Attempting to re-initialize memory allocator\n");
+    if (umeminit(8192, WORST_FIT) == 0) {
+        printf("Initialization successful.\n");
+    } else {
+        printf("Already initialized memory\n");
+    }
+
+    return 0; 
+}
+
+int doubleFree(){
+    
+    printf("Initializing memory allocator\n");
+    if (umeminit(4096, BEST_FIT) == 0) { // size of heap is 4096 and it is using the best fit algorithm
+        printf("Initialization successful.\n");
+    } else {
+        printf("Initialization failed.\n");
+        return 1;
+    }
+        printf("\n");
+
+    // Test 1: Allocate another memory block and check if it succeeds
+    printf("Test 1: Allocating a memory block of 64 bytes\n");
+    void *ptr5 = umalloc(64);
+    if (ptr5 != NULL) {
+        printf("Allocation successful. Pointer: %p\n", ptr5);
+    } else {
+        printf("Allocation failed.\n");
+    }
+        
+    	umemstats();
+        printf("\n");
+
+     // Test 2: Free the first memory block
+    printf("Test 2: Freeing the first memory block\n");
+    if (ufree(ptr5) == 1) {
+        printf("Free successful.\n");
+    } else {
+        printf("Free failed.\n");
+    }
+        printf("\n");
+
+    // Test 3: Attempt double-free on the same block (should detect and handle it)
+    printf("Test 3: Attempting double-free on the first memory block\n");
+    if (ufree(ptr5) == 1) {
+        printf("Double-free detected and not handled.\n");
+    }
+        printf("\n");
+    return 0;
+}
+
+int testNextFit() {
+    printf("Initializing memory allocator with NEXT_FIT algorithm\n");
+    if (umeminit(1024, NEXT_FIT) == 0) { // Initialize with 1024 bytes
+        printf("Initialization successful.\n");
+    } else {
+        printf("Initialization failed.\n");
+        return 1;
+    }
+
+    // Allocate multiple blocks to see the "next fit" behavior
+    printf("Allocating 100 bytes\n");
+    void *ptr1 = umalloc(100);
+    printf("Allocating 200 bytes\n");
+    void *ptr2 = umalloc(200);
+    printf("Allocating 50 bytes\n");
+    void *ptr3 = umalloc(50);
+
+    printf("\n");
+    umemstats();
+    printf("\n");
+
+    // Free first block to create space for next fit
+    printf("Freeing 100-byte block\n");
+    ufree(ptr1);
+
+    printf("\n");
+    umemstats();
+    printf("\n");
+
+    // Allocate a block that should use the space freed by ptr1
+    printf("Allocating 90 bytes (Next Fit should select the free 100-byte block)\n");
+    void *ptr4 = umalloc(90);
+
+    if (ptr4) {
+        printf("Allocation successful.\n");
+    } else {
+        printf("Allocation failed.\n");
+    }
+
+    printf("\n");
+    umemstats();
+
+    // Clean up
+    ufree(ptr2);
+    ufree(ptr3);
+    ufree(ptr4);
+
+    return 0;
+}
+int testWorstFit() {
+    printf("Initializing memory allocator with WORST_FIT algorithm\n");
+    if (umeminit(1024, WORST_FIT) == 0) { // Initialize with 1024 bytes
+        printf("Initialization successful.\n");
+    } else {
+        printf("Initialization failed.\n");
+        return 1;
+    }
+
+    // Allocate multiple blocks and then free some to create large gaps
+    printf("Allocating 100 bytes\n");
+    void *ptr1 = umalloc(100);
+    printf("Allocating 200 bytes\n");
+    void *ptr2 = umalloc(200);
+    printf("Allocating 50 bytes\n");
+    void *ptr3 = umalloc(50);
+
+    printf("Freeing 200-byte block\n");
+    ufree(ptr2);
+
+    // Now, we have a large free block of 200 bytes
+    printf("Allocating 80 bytes (Worst Fit should select the 200-byte block)\n");
+    void *ptr4 = umalloc(80);
+
+    if (ptr4) {
+        printf("Allocation successful.\n");
+    } else {
+        printf("Allocation failed.\n");
+    }
+    umemstats();
+
+    // Clean up
+    ufree(ptr1);
+    ufree(ptr3);
+    ufree(ptr4);
+
+    return 0;
+}
+int testFirstFit() {
+    printf("Initializing memory allocator with FIRST_FIT algorithm\n");
+    if (umeminit(1024, FIRST_FIT) == 0) { // Initialize with 1024 bytes
+        printf("Initialization successful.\n");
+    } else {
+        printf("Initialization failed.\n");
+        return 1;
+    }
+
+    // Allocate blocks and then free some to create gaps
+    printf("Allocating 100 bytes\n");
+    void *ptr1 = umalloc(100);
+    printf("Allocating 50 bytes\n");
+    void *ptr2 = umalloc(50);
+    printf("Allocating 200 bytes\n");
+    void *ptr3 = umalloc(200);
+
+    printf("Freeing 100-byte block\n");
+    ufree(ptr1);
+
+    // Attempt to allocate 80 bytes, which should fit into the first free block (100 bytes)
+    printf("Allocating 80 bytes (First Fit should select the 100-byte block)\n");
+    void *ptr4 = umalloc(80);
+
+    if (ptr4) {
+        printf("Allocation successful.\n");
+    } else {
+        printf("Allocation failed.\n");
+    }
+    umemstats();
+
+    // Clean up
+    ufree(ptr2);
+    ufree(ptr3);
+    ufree(ptr4);
+
+    return 0;
+}
+
+int testEmpty(){
+
+    printf("Initializing memory allocator with WORST_FIT algorithm, but 0 Bytes\n");
+    if (umeminit(0, WORST_FIT) == 0) { // Initialize with 1024 bytes
+        printf("Initialization successful.\n");
+    } else {
+        printf("Initialization failed.\n");
+        return 1;
+    }
+    return 0;
+
+}
+int testStress() {
+    printf("Stress Testing with Many Small Allocations\n");
+    umeminit(4096, FIRST_FIT);
+
+    void *pointers[50];
+    for (int i = 0; i < 50; i++) {
+        pointers[i] = umalloc(10);  // Allocate 50 small blocks
+    }
+    umemstats();
+
+    printf("\n");
+    // Free all blocks in reverse order to check stability
+    for (int i = 49; i >= 0; i--) {
+        ufree(pointers[i]);
+    }
+    umemstats();
+    return 0;
+}
+
+
+int testBuddy() {
+    printf("Initializing memory allocator with BUDDY algorithm\n");
+    if (umeminit(4096, BUDDY) == 0) {
+        printf("Initialization successful.\n");
+    } else {
+        printf("Initialization failed.\n");
+        return 1;
+    }
+
+    // Requests round up to the next power of two, header included
+    printf("Allocating 100 bytes (should take a 128-byte block)\n");
+    void *ptr1 = umalloc(100);
+    printf("Allocating 200 bytes (should take a 256-byte block)\n");
+    void *ptr2 = umalloc(200);
+    printf("Allocating 10 bytes (should take a 32-byte block)\n");
+    void *ptr3 = umalloc(10);
+
+    if (ptr1 && ptr2 && ptr3) {
+        printf("Allocation successful.\n");
+    } else {
+        printf("Allocation failed.\n");
+    }
+    umemstats();
+    printf("\n");
+
+    // Freeing everything should merge the buddies back into the original blocks
+    printf("Freeing all blocks\n");
+    ufree(ptr3);
+    ufree(ptr1);
+    ufree(ptr2);
+    umemstats();
+    printf("\n");
+
+    printf("Allocating 2000 bytes (only possible if the buddies merged again)\n");
+    void *ptr4 = umalloc(2000);
+    if (ptr4) {
+        printf("Allocation successful.\n");
+    } else {
+        printf("Allocation failed.\n");
+    }
+    ufree(ptr4);
+    printf("\n");
+
+    // The bitmaps take the front of the heap, so no block reaches 4 KB
+    printf("Allocating 3000 bytes (bigger than any buddy block, should fail)\n");
+    void *ptr5 = umalloc(3000);
+    if (ptr5) {
+        printf("Allocation succeeded unexpectedly.\n");
+        ufree(ptr5);
+    } else {
+        printf("Allocation failed as expected.\n");
+    }
+
+    return 0;
+}
+
+int testTLSF() {
+    printf("Initializing memory allocator with TLSF algorithm\n");
+    if (umeminit(4096, TLSF) == 0) {
+        printf("Initialization successful.\n");
+    } else {
+        printf("Initialization failed.\n");
+        return 1;
+    }
+
+    // Leave two holes of different size classes between live blocks
+    printf("Allocating 100, 50, 300 and 50 bytes\n");
+    void *ptr1 = umalloc(100);
+    void *ptr2 = umalloc(50);
+    void *ptr3 = umalloc(300);
+    void *ptr4 = umalloc(50);
+
+    printf("Freeing the 100-byte and 300-byte blocks\n");
+    ufree(ptr1);
+    ufree(ptr3);
+    umemstats();
+    printf("\n");
+
+    // A good fit comes from the first non-empty size class that is large enough
+    printf("Allocating 200 bytes (TLSF should select the 300-byte block)\n");
+    void *ptr5 = umalloc(200);
+    if (ptr5 == ptr3) {
+        printf("Allocation successful.\n");
+    } else {
+        printf("Allocation did not reuse the 300-byte block.\n");
+    }
+    umemstats();
+    printf("\n");
+
+    // Clean up
+    ufree(ptr2);
+    ufree(ptr4);
+    ufree(ptr5);
+    umemstats();
+
+    return 0;
+}
+
+int testArenas() {
+    printf("Initializing memory allocator with 2 FIRST_FIT arenas\n");
+    if (umeminit_arenas(8192, FIRST_FIT, 2) == 0) {
+        printf("Initialization successful.\n");
+    } else {
+        printf("Initialization failed.\n");
+        return 1;
+    }
+
+    // A single thread always starts in the same arena; once it is full,
+    // requests spill into the other one
+    printf("Allocating 3000 bytes twice (the second should come from the other arena)\n");
+    void *ptr1 = umalloc(3000);
+    void *ptr2 = umalloc(3000);
+    if (ptr1 != NULL && ptr2 != NULL && (char *)ptr2 - (char *)ptr1 >= 4096) {
+        printf("Allocation successful.\n");
+    } else {
+        printf("Allocation did not spill into the second arena.\n");
+    }
+    umemstats();
+    printf("\n");
+
+    // Each block goes back to the arena it came from
+    printf("Freeing both blocks and allocating 3000 bytes again\n");
+    ufree(ptr1);
+    ufree(ptr2);
+    void *ptr3 = umalloc(3000);
+    if (ptr3 == ptr1) {
+        printf("Allocation successful.\n");
+    } else {
+        printf("Allocation did not come from the first arena.\n");
+    }
+    ufree(ptr3);
+    umemstats();
+
+    return 0;
+}
+
+int testHeaps() {
+    printf("Creating a BEST_FIT heap and a TLSF heap\n");
+    umem_heap_t *small = umem_heap_create(4096, BEST_FIT, 1);
+    umem_heap_t *large = umem_heap_create(16384, TLSF, 1);
+    if (small != NULL && large != NULL) {
+        printf("Creation successful.\n");
+    } else {
+        printf("Creation failed.\n");
+        return 1;
+    }
+
+    // Each heap hands out blocks from its own region and keeps its own stats
+    printf("Allocating 100 bytes from each heap and 8000 bytes from the TLSF heap\n");
+    void *ptr1 = umalloc_from(small, 100);
+    void *ptr2 = umalloc_from(large, 100);
+    void *ptr3 = umalloc_from(large, 8000);
+    if (ptr1 != NULL && ptr2 != NULL && ptr3 != NULL) {
+        printf("Allocation successful.\n");
+    } else {
+        printf("Allocation failed.\n");
+    }
+    umemstats_from(small);
+    umemstats_from(large);
+    printf("\n");
+
+    printf("Freeing the BEST_FIT block and destroying both heaps\n");
+    ufree_to(small, ptr1);
+    umemstats_from(small);
+    if (umem_heap_destroy(small) == 0 && umem_heap_destroy(large) == 0) {
+        printf("Destroy successful.\n");  // ptr2 and ptr3 went with their heap
+    } else {
+        printf("Destroy failed.\n");
+    }
+
+    return 0;
+}
+
+int testGrowth() {
+    printf("Creating a 4096-byte FIRST_FIT heap that may grow to 64 KB\n");
+    umem_heap_t *heap = umem_heap_create(4096, FIRST_FIT, 1);
+    if (heap != NULL && umem_heap_grow(heap, 65536) == 0) {
+        printf("Creation successful.\n");
+    } else {
+        printf("Creation failed.\n");
+        return 1;
+    }
+
+    // More than the initial region holds; the heap maps chunks to cover it
+    printf("Allocating 3000 bytes three times\n");
+    void *ptr1 = umalloc_from(heap, 3000);
+    void *ptr2 = umalloc_from(heap, 3000);
+    void *ptr3 = umalloc_from(heap, 3000);
+    if (ptr1 != NULL && ptr2 != NULL && ptr3 != NULL) {
+        printf("Allocation successful.\n");
+    } else {
+        printf("Allocation failed.\n");
+    }
+    umemstats_from(heap);
+    printf("\n");
+
+    // The cap still applies
+    printf("Allocating 100000 bytes (should fail, the heap is capped at 64 KB)\n");
+    void *ptr4 = umalloc_from(heap, 100000);
+    if (ptr4 == NULL) {
+        printf("Allocation failed as expected.\n");
+    } else {
+        printf("Allocation unexpectedly succeeded.\n");
+    }
+
+    ufree_to(heap, ptr1);
+    ufree_to(heap, ptr2);
+    ufree_to(heap, ptr3);
+    umemstats_from(heap);
+    umem_heap_destroy(heap);
+
+    return 0;
+}
+
+int testRelease() {
+    printf("Creating a 1 MB FIRST_FIT heap that releases free blocks of 64 KB or more at once\n");
+    umem_heap_t *heap = umem_heap_create(1 << 20, FIRST_FIT, 1);
+    if (heap != NULL && umem_heap_set_decay(heap, 64 * 1024, 0) == 0) {
+        printf("Creation successful.\n");
+    } else {
+        printf("Creation failed.\n");
+        return 1;
+    }
+
+    // Touch half the heap so its pages are resident, then free it
+    printf("Allocating, filling and freeing 100 KB\n");
+    char *ptr1 = umalloc_from(heap, 100 * 1024);
+    if (ptr1 == NULL) {
+        printf("Allocation failed.\n");
+        return 1;
+    }
+    memset(ptr1, 0xAB, 100 * 1024);
+    ufree_to(heap, ptr1);
+    umemstats_from(heap);  // Released Memory should now be close to 1 MB
+    printf("\n");
+
+    // Released pages come back zeroed and work like any other memory
+    printf("Allocating 100 KB again\n");
+    char *ptr2 = umalloc_from(heap, 100 * 1024);
+    if (ptr2 != NULL) {
+        memset(ptr2, 0xCD, 100 * 1024);
+        printf("Allocation successful.\n");
+    } else {
+        printf("Allocation failed.\n");
+    }
+    ufree_to(heap, ptr2);
+    umemstats_from(heap);  // Only the 100 KB touched again is released again
+    umem_heap_destroy(heap);
+
+    return 0;
+}
+
+int testRealloc() {
+    printf("Initializing memory allocator with FIRST_FIT algorithm\n");
+    if (umeminit(4096, FIRST_FIT) == 0) {
+        printf("Initialization successful.\n");
+    } else {
+        printf("Initialization failed.\n");
+        return 1;
+    }
+
+    // The block after ptr1 is free, so growing should not move it
+    printf("Allocating 100 bytes and growing it to 1000 bytes\n");
+    char *ptr1 = umalloc(100);
+    strcpy(ptr1, "kept in place");
+    char *ptr2 = urealloc(ptr1, 1000);
+    if (ptr2 == ptr1 && strcmp(ptr2, "kept in place") == 0) {
+        printf("Reallocation successful (grew in place).\n");
+    } else {
+        printf("Reallocation moved the block.\n");
+    }
+    umemstats();
+    printf("\n");
+
+    // Shrinking hands the tail back, so the next allocation lands right after it
+    printf("Shrinking it to 200 bytes and allocating 500 bytes\n");
+    char *ptr3 = urealloc(ptr2, 200);
+    char *ptr4 = umalloc(500);
+    if (ptr3 == ptr1 && ptr4 == ptr3 + 200 + sizeof(header_t)) {
+        printf("Reallocation successful (tail returned).\n");
+    } else {
+        printf("Reallocation did not return the tail.\n");
+    }
+    umemstats();
+    printf("\n");
+
+    // With ptr4 in the way it has to move
+    printf("Growing the 200-byte block to 800 bytes (should move)\n");
+    char *ptr5 = urealloc(ptr3, 800);
+    if (ptr5 != ptr3 && strcmp(ptr5, "kept in place") == 0) {
+        printf("Reallocation successful (moved).\n");
+    } else {
+        printf("Reallocation failed.\n");
+    }
+
+    ufree(ptr4);
+    ufree(ptr5);
+    umemstats();
+
+    return 0;
+}
+
+int testLarge() {
+    printf("Initializing memory allocator with BEST_FIT algorithm\n");
+    if (umeminit(4096, BEST_FIT) == 0) {
+        printf("Initialization successful.\n");
+    } else {
+        printf("Initialization failed.\n");
+        return 1;
+    }
+
+    // Far bigger than the heap, but above the threshold it gets its own mapping
+    printf("Allocating 1 MB from a 4096-byte heap\n");
+    char *ptr1 = umalloc(1 << 20);
+    if (ptr1 != NULL) {
+        memset(ptr1, 0x5A, 1 << 20);
+        printf("Allocation successful.\n");
+    } else {
+        printf("Allocation failed.\n");
+        return 1;
+    }
+    umemstats();
+    printf("\n");
+
+    // mremap carries the contents along without copying them
+    printf("Growing it to 4 MB\n");
+    char *ptr2 = urealloc(ptr1, 4 << 20);
+    if (ptr2 != NULL && ptr2[(1 << 20) - 1] == 0x5A) {
+        printf("Reallocation successful.\n");
+    } else {
+        printf("Reallocation failed.\n");
+    }
+
+    // Small blocks still come from the heap itself
+    void *ptr3 = umalloc(100);
+    ufree(ptr2);
+    ufree(ptr3);
+    umemstats();
+
+    return 0;
+}
+
+int testPool() {
+    printf("Initializing memory allocator with FIRST_FIT algorithm\n");
+    if (umeminit(256 * 1024, FIRST_FIT) == 0) {
+        printf("Initialization successful.\n");
+    } else {
+        printf("Initialization failed.\n");
+        return 1;
+    }
+
+    printf("Creating a pool of 24-byte objects\n");
+    upool_t *pool = upool_create(24);
+    if (pool == NULL) {
+        printf("Creation failed.\n");
+        return 1;
+    }
+
+    // Objects sit back to back: no header between them
+    printf("Allocating 1000 objects\n");
+    char *objects[1000];
+    int packed = 1;
+    for (int i = 0; i < 1000; i++) {
+        objects[i] = upool_alloc(pool);
+        if (objects[i] == NULL || (i > 0 && objects[i] != objects[i - 1] + 24)) {
+            packed = 0;
+        }
+    }
+    if (packed) {
+        printf("Allocation successful (objects are 24 bytes apart).\n");
+    } else {
+        printf("Objects are not packed.\n");
+    }
+    umemstats();  // One slab, not a thousand blocks
+    printf("\n");
+
+    // A freed object is the next one handed out
+    printf("Freeing object 500 and allocating again\n");
+    upool_free(pool, objects[500]);
+    if (upool_alloc(pool) == objects[500]) {
+        printf("Allocation successful (object reused).\n");
+    } else {
+        printf("Object was not reused.\n");
+    }
+
+    printf("Destroying the pool\n");
+    upool_destroy(pool);
+    umemstats();
+
+    return 0;
+}
+
+int testBumpArena() {
+    printf("Initializing memory allocator with BEST_FIT algorithm\n");
+    if (umeminit(64 * 1024, BEST_FIT) == 0) {
+        printf("Initialization successful.\n");
+    } else {
+        printf("Initialization failed.\n");
+        return 1;
+    }
+
+    printf("Creating a bump arena with 4096-byte chunks\n");
+    uarena_t *arena = uarena_create(4096);
+    if (arena == NULL) {
+        printf("Creation failed.\n");
+        return 1;
+    }
+
+    // Consecutive requests come from consecutive addresses
+    printf("Allocating 100 objects of 40 bytes and one of 3000 bytes\n");
+    char *first = uarena_alloc(arena, 40);
+    char *last = first;
+    for (int i = 1; i < 100; i++) {
+        last = uarena_alloc(arena, 40);
+    }
+    char *big = uarena_alloc(arena, 3000);  // Gets a chunk of its own
+    if (first != NULL && last != NULL && big != NULL) {
+        printf("Allocation successful.\n");
+    } else {
+        printf("Allocation failed.\n");
+    }
+    umemstats();  // A handful of chunks, not a hundred blocks
+    printf("\n");
+
+    // Reset keeps one chunk and starts over at its beginning
+    printf("Resetting the arena and allocating 40 bytes\n");
+    uarena_reset(arena);
+    if (uarena_alloc(arena, 40) == first) {
+        printf("Allocation successful (arena rewound).\n");
+    } else {
+        printf("Arena was not rewound.\n");
+    }
+    umemstats();
+    printf("\n");
+
+    printf("Destroying the arena\n");
+    uarena_destroy(arena);
+    umemstats();
+
+    return 0;
+}
+
+int testAligned() {
+    printf("Initializing memory allocator with BEST_FIT algorithm\n");
+    if (umeminit(64 * 1024, BEST_FIT) == 0) {
+        printf("Initialization successful.\n");
+    } else {
+        printf("Initialization failed.\n");
+        return 1;
+    }
+
+    // The slack in front of each aligned block goes back to the free list
+    printf("Allocating 100 bytes aligned to 64 and 1000 bytes aligned to 4096\n");
+    void *ptr1 = ualigned_alloc(64, 100);
+    void *ptr2 = ualigned_alloc(4096, 1000);
+    if (ptr1 != NULL && ptr2 != NULL && (size_t)ptr1 % 64 == 0 && (size_t)ptr2 % 4096 == 0) {
+        printf("Allocation successful (both aligned).\n");
+    } else {
+        printf("Allocation failed or misaligned.\n");
+    }
+    umemstats();
+    printf("\n");
+
+    printf("Allocating with uposix_memalign and bad alignments of 24 and 0\n");
+    void *ptr3 = NULL;
+    if (uposix_memalign(&ptr3, 24, 100) == EINVAL && uposix_memalign(&ptr3, 0, 100) == EINVAL &&
+        uposix_memalign(&ptr3, 256, 100) == 0 && (size_t)ptr3 % 256 == 0) {
+        printf("Allocation successful (24 and 0 rejected, 256 aligned).\n");
+    } else {
+        printf("Allocation failed.\n");
+    }
+
+    // Plain ufree takes aligned blocks back
+    printf("Freeing all three\n");
+    ufree(ptr1);
+    ufree(ptr2);
+    ufree(ptr3);
+    umemstats();
+
+    return 0;
+}
+
+int testBatch() {
+    printf("Initializing memory allocator with FIRST_FIT algorithm\n");
+    if (umeminit(64 * 1024, FIRST_FIT) == 0) {
+        printf("Initialization successful.\n");
+    } else {
+        printf("Initialization failed.\n");
+        return 1;
+    }
+
+    // One split serves the whole batch, so the blocks sit back to back
+    printf("Allocating a batch of 200 blocks of 48 bytes\n");
+    void *ptrs[200];
+    size_t got = umalloc_batch(48, 200, ptrs);
+    if (got == 200 && (char *)ptrs[199] - (char *)ptrs[0] == 199 * (48 + sizeof(header_t))) {
+        printf("Allocation successful (blocks are contiguous).\n");
+    } else {
+        printf("Allocation failed (%zu blocks).\n", got);
+    }
+    umemstats();
+    printf("\n");
+
+    // They merge back into a single free block on the way out
+    printf("Freeing the batch in reverse order\n");
+    for (int i = 0; i < 100; i++) {
+        void *tmp = ptrs[i];
+        ptrs[i] = ptrs[199 - i];
+        ptrs[199 - i] = tmp;
+    }
+    ufree_batch(ptrs, got);
+    umemstats();
+
+    return 0;
+}
+
+int testSnapshot() {
+    printf("Initializing memory allocator with TLSF algorithm\n");
+    if (umeminit(64 * 1024, TLSF) == 0) {
+        printf("Initialization successful.\n");
+    } else {
+        printf("Initialization failed.\n");
+        return 1;
+    }
+
+    // Freeing every other block leaves holes that cannot merge. The blocks
+    // are too big for the fastbins, so the holes really are free.
+    printf("Allocating 10 blocks of 200 bytes and freeing every other one\n");
+    void *ptrs[10];
+    for (int i = 0; i < 10; i++) {
+        ptrs[i] = umalloc(200);
+    }
+    for (int i = 0; i < 10; i += 2) {
+        ufree(ptrs[i]);
+    }
+
+    umem_stats_t stats;
+    umemsnapshot(&stats);
+    printf("Free blocks: %zu, free bytes: %zu, largest free block: %zu\n",
+           stats.freeBlocks, stats.freeBytes, stats.largestFree);
+    printf("Blocks of 128 to 255 bytes: %zu\n", stats.freeClasses[3]);
+    umemstats_json(stdout);
+
+    for (int i = 1; i < 10; i += 2) {
+        ufree(ptrs[i]);
+    }
+    printf("\n");
+
+    // FIRST_FIT has no size index. Each allocation below is too big for the
+    // holes and carves the biggest block, yet a snapshot must not have to
+    // walk all 20000 holes to find the next biggest.
+    printf("Leaving 20000 holes in a 16 MB FIRST_FIT heap, then allocating 1000 bytes and snapshotting 1000 times\n");
+    umem_heap_t *heap = umem_heap_create(16 << 20, FIRST_FIT, 1);
+    if (heap == NULL) {
+        printf("Creation failed.\n");
+        return 1;
+    }
+    static void *holes[40000];
+    for (int i = 0; i < 40000; i++) {
+        holes[i] = umalloc_from(heap, 200);
+    }
+    for (int i = 0; i < 40000; i += 2) {
+        ufree_to(heap, holes[i]);
+    }
+    long elapsed = 0;
+    for (int i = 0; i < 1000; i++) {
+        struct timespec start, end;
+        umalloc_from(heap, 1000);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        umemsnapshot_from(heap, &stats);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        elapsed += (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+    }
+    printf("Free blocks: %zu, largest free block: %zu, %.2f us per snapshot\n",
+           stats.freeBlocks, stats.largestFree, elapsed / 1000.0 / 1000);
+    umem_heap_destroy(heap);
+
+    return 0;
+}
+
+int testTrace() {
+    printf("Initializing memory allocator with FIRST_FIT algorithm\n");
+    if (umeminit(64 * 1024, FIRST_FIT) == 0) {
+        printf("Initialization successful.\n");
+    } else {
+        printf("Initialization failed.\n");
+        return 1;
+    }
+
+    printf("Recording a trace to umem.trace\n");
+    if (umemtrace_start("umem.trace") != 0) {
+        printf("Could not open the trace.\n");
+        return 1;
+    }
+
+    // Each call below becomes one 32-byte record
+    void *ptrs[20];
+    for (int i = 0; i < 20; i++) {
+        ptrs[i] = umalloc(32 + i * 16);
+    }
+    for (int i = 0; i < 20; i += 2) {
+        ptrs[i] = urealloc(ptrs[i], 1000);
+    }
+    for (int i = 0; i < 20; i++) {
+        ufree(ptrs[i]);
+    }
+
+    // Aligned and batch blocks are recorded one by one as well
+    void *aligned = ualigned_alloc(256, 100);
+    void *batch[10];
+    size_t got = umalloc_batch(48, 10, batch);
+    ufree(aligned);
+    ufree_batch(batch, got);
+
+    umemtrace_stop();
+    printf("Recorded %zu calls; compare the policies with ./replay umem.trace\n", 52 + 2 * got);
+    umemstats();
+
+    return 0;
+}
+
+int testHugePages() {
+    printf("Initializing memory allocator with BEST_FIT algorithm on huge pages\n");
+    if (umeminit_flags(4 * 1024 * 1024, BEST_FIT, 1, UMEM_HUGE_PAGES) == 0) {
+        printf("Initialization successful.\n");
+    } else {
+        printf("Initialization failed.\n");
+        return 1;
+    }
+
+    // Without reserved huge pages the heap falls back to transparent ones,
+    // and without those to base pages; umemstats says which it got
+    printf("Allocating 100 blocks of 1000 bytes\n");
+    void *ptrs[100];
+    for (int i = 0; i < 100; i++) {
+        ptrs[i] = umalloc(1000);
+        memset(ptrs[i], i, 1000);
+    }
+    umemstats();
+
+    for (int i = 0; i < 100; i++) {
+        ufree(ptrs[i]);
+    }
+
+    return 0;
+}
+
+int testCompactHeader() {
+    // Build main.c and umem.c with -DUMEM_COMPACT_HEADER to compare: the
+    // header drops to 8 bytes and the smallest block to 16
+    printf("Header size: %zu bytes\n", sizeof(header_t));
+    printf("Initializing memory allocator with FIRST_FIT algorithm\n");
+    if (umeminit(4096, FIRST_FIT) == 0) {
+        printf("Initialization successful.\n");
+    } else {
+        printf("Initialization failed.\n");
+        return 1;
+    }
+
+    printf("Allocating 50 blocks of 8 bytes\n");
+    void *ptrs[50];
+    for (int i = 0; i < 50; i++) {
+        ptrs[i] = umalloc(8);
+    }
+    umemstats();
+
+    // Blocks too small for the free lists wait in their fastbin until reused
+    for (int i = 0; i < 50; i++) {
+        ufree(ptrs[i]);
+    }
+    umemstats();
+
+    return 0;
+}
+
+typedef struct note {
+    struct note *next;
+    char text[32];
+} note_t;
+
+int testPersist() {
+    // The heap is made and filled by a child, so the reopen below is a warm
+    // restart in a process that has never mapped the file
+    printf("Creating a TLSF heap in umem.heap from a child process\n");
+    remove("umem.heap");
+    int channel[2];
+    if (pipe(channel) != 0) {
+        printf("Creation failed.\n");
+        return 1;
+    }
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        umem_heap_t *heap = umem_heap_open("umem.heap", 1024 * 1024, TLSF, 1);
+        if (heap == NULL) {
+            _exit(1);
+        }
+
+        // A list built from plain pointers, reachable from the heap's root
+        note_t *list = NULL;
+        for (int i = 0; i < 5; i++) {
+            note_t *note = umalloc_from(heap, sizeof(note_t));
+            snprintf(note->text, sizeof(note->text), "note %d", i);
+            note->next = list;
+            list = note;
+        }
+        ufree_to(heap, umalloc_from(heap, 5000));  // Leaves a free block behind
+        umem_heap_set_root(heap, list);
+        if (write(channel[1], &heap, sizeof(heap)) != sizeof(heap)) {
+            _exit(1);
+        }
+        umem_heap_destroy(heap);
+        _exit(0);
+    }
+
+    umem_heap_t *created = NULL;
+    int status = 0;
+    if (read(channel[0], &created, sizeof(created)) != sizeof(created)) {
+        created = NULL;
+    }
+    waitpid(child, &status, 0);
+    close(channel[0]);
+    close(channel[1]);
+    if (created == NULL || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("Creation failed.\n");
+        return 1;
+    }
+
+    printf("Reopening umem.heap in this process\n");
+    umem_heap_t *heap = umem_heap_open("umem.heap", 0, 0, 0);
+    if (heap == NULL) {
+        printf("Reopening failed.\n");
+        return 1;
+    }
+    if (heap == created) {
+        printf("Reattached at the address it was created at.\n");
+    } else {
+        printf("Reattached at %p instead of %p.\n", (void *)heap, (void *)created);
+    }
+    for (note_t *note = umem_heap_root(heap); note != NULL; note = note->next) {
+        printf("Found %s at %p\n", note->text, (void *)note);
+    }
+    umemstats_from(heap);
+
+    for (note_t *note = umem_heap_root(heap), *next; note != NULL; note = next) {
+        next = note->next;
+        ufree_to(heap, note);
+    }
+    umem_heap_destroy(heap);
+    printf("\n");
+
+    // A process that dies with the file open leaves it marked unclean
+    printf("Opening umem.heap in a child that exits without closing it\n");
+    fflush(stdout);
+    child = fork();
+    if (child == 0) {
+        _exit(umem_heap_open("umem.heap", 0, 0, 0) == NULL);
+    }
+    waitpid(child, &status, 0);
+    heap = umem_heap_open("umem.heap", 0, 0, 0);
+    if (heap == NULL) {
+        printf("Reopening refused as expected.\n");
+    } else {
+        printf("Reopening succeeded unexpectedly.\n");
+        umem_heap_destroy(heap);
+    }
+
+    // The only way back is to start the file over
+    remove("umem.heap");
+    heap = umem_heap_open("umem.heap", 1024 * 1024, TLSF, 1);
+    if (heap != NULL) {
+        printf("Started over with an empty heap.\n");
+        umem_heap_destroy(heap);
+    }
+    remove("umem.heap");
+
+    return 0;
+}
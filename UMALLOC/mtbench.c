@@ -0,0 +1,215 @@
+// Multi-threaded scalability benchmark in the style of larson and
+// threadtest: every thread keeps a set of live blocks and keeps replacing
+// random ones, and one block in eight is handed to the next thread to free
+// instead of being freed where it was allocated. Aggregate calls per second
+// are reported for 1, 2, 4, ... threads.
+//
+// Build: gcc -O2 -DUMEM_THREADSAFE -pthread -o mtbench mtbench.c umem.c
+// Usage: ./mtbench [maxThreads] [policy] [callsPerThread]
+//
+// Configurations, each on a heap of its own that may grow:
+//   glibc         malloc and free
+//   global mutex  one umem arena behind a single process-wide mutex, the way
+//                 the allocator had to be shared before it had locks
+//   arenas        an explicit heap with an arena per thread
+//   default heap  umalloc and ufree: an arena per thread plus the thread cache
+#include "umem.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef UMEM_THREADSAFE
+#error "mtbench measures the thread-safe build: compile it and umem.c with -DUMEM_THREADSAFE -pthread"
+#endif
+
+#define SLOTS    1000      // Live blocks per thread
+#define MIN_SIZE 16
+#define MAX_SIZE 512       // Block sizes are uniform in [MIN_SIZE, MAX_SIZE]
+#define HANDOFF  8         // One block in HANDOFF is freed by another thread
+
+enum { GLIBC, GLOBAL_MUTEX, ARENAS, DEFAULT_HEAP, CONFIGS };
+static const char *configNames[CONFIGS] = {"glibc", "global mutex", "arenas", "default heap"};
+
+static int config;
+static umem_heap_t *heap;  // For GLOBAL_MUTEX and ARENAS
+static pthread_mutex_t globalMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t startLine;
+static size_t callsPerThread;
+static int threadCount;
+
+typedef struct {
+    int id;
+    void *inbox[SLOTS];    // Blocks handed over by the previous thread
+    char pad[64];          // Keeps neighbouring threads' inboxes off one cache line
+} worker_t;
+
+static worker_t *workers;
+
+static void *benchAlloc(size_t size) {
+    void *ptr;
+    switch (config) {
+        case GLIBC:
+            return malloc(size);
+        case GLOBAL_MUTEX:
+            pthread_mutex_lock(&globalMutex);
+            ptr = umalloc_from(heap, size);
+            pthread_mutex_unlock(&globalMutex);
+            return ptr;
+        case ARENAS:
+            return umalloc_from(heap, size);
+        default:
+            return umalloc(size);
+    }
+}
+
+static void benchFree(void *ptr) {
+    switch (config) {
+        case GLIBC:
+            free(ptr);
+            break;
+        case GLOBAL_MUTEX:
+            pthread_mutex_lock(&globalMutex);
+            ufree_to(heap, ptr);
+            pthread_mutex_unlock(&globalMutex);
+            break;
+        case ARENAS:
+            ufree_to(heap, ptr);
+            break;
+        default:
+            ufree(ptr);
+    }
+}
+
+static void *work(void *arg) {
+    worker_t *self = arg;
+    worker_t *next = &workers[(self->id + 1) % threadCount];
+    void *slots[SLOTS] = {0};
+    unsigned seed = self->id * 2654435761u + 1;
+
+    pthread_barrier_wait(&startLine);
+    for (size_t call = 0; call < callsPerThread; call += 2) {
+        int i = rand_r(&seed) % SLOTS;
+        if (slots[i] != NULL) {
+            if (rand_r(&seed) % HANDOFF == 0) {
+                void *old = __atomic_exchange_n(&next->inbox[i], slots[i], __ATOMIC_ACQ_REL);
+                if (old != NULL) {
+                    benchFree(old);  // The next thread has not got to it yet
+                }
+            } else {
+                benchFree(slots[i]);
+            }
+        }
+        slots[i] = benchAlloc(MIN_SIZE + rand_r(&seed) % (MAX_SIZE - MIN_SIZE + 1));
+        if (slots[i] != NULL) {
+            *(char *)slots[i] = 1;
+        }
+
+        void *handed = __atomic_exchange_n(&self->inbox[i], NULL, __ATOMIC_ACQ_REL);
+        if (handed != NULL) {
+            benchFree(handed);
+        }
+    }
+
+    for (int i = 0; i < SLOTS; i++) {
+        if (slots[i] != NULL) {
+            benchFree(slots[i]);
+        }
+    }
+    return NULL;
+}
+
+static double seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Calls per second for one configuration at one thread count
+static double run(int threads, int algo) {
+    threadCount = threads;
+    if (config == GLOBAL_MUTEX || config == ARENAS) {
+        heap = umem_heap_create(64 << 20, algo, config == ARENAS ? threads : 1);
+        if (heap == NULL) {
+            return -1;
+        }
+        umem_heap_grow(heap, 0);
+    }
+
+    workers = calloc(threads, sizeof(worker_t));
+    pthread_t *ids = malloc(threads * sizeof(pthread_t));
+    pthread_barrier_init(&startLine, NULL, threads + 1);
+    for (int t = 0; t < threads; t++) {
+        workers[t].id = t;
+        pthread_create(&ids[t], NULL, work, &workers[t]);
+    }
+
+    pthread_barrier_wait(&startLine);
+    double start = seconds();
+    for (int t = 0; t < threads; t++) {
+        pthread_join(ids[t], NULL);
+    }
+    double elapsed = seconds() - start;
+
+    // Blocks still waiting in an inbox when their receiver finished
+    for (int t = 0; t < threads; t++) {
+        for (int i = 0; i < SLOTS; i++) {
+            if (workers[t].inbox[i] != NULL) {
+                benchFree(workers[t].inbox[i]);
+            }
+        }
+    }
+    pthread_barrier_destroy(&startLine);
+    free(ids);
+    free(workers);
+    if (heap != NULL) {
+        umem_heap_destroy(heap);
+        heap = NULL;
+    }
+    return threads * (double)callsPerThread / elapsed;
+}
+
+int main(int argc, char **argv) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int maxThreads = argc > 1 ? atoi(argv[1]) : (int)(cores > 0 ? cores : 4);
+    int algo = argc > 2 ? atoi(argv[2]) : TLSF;
+    callsPerThread = argc > 3 ? strtoul(argv[3], NULL, 0) : 1000000;
+    if (maxThreads < 1 || maxThreads > 64 || algo < BEST_FIT || algo > TLSF) {
+        fprintf(stderr, "Usage: %s [maxThreads (1-64)] [policy (1-6)] [callsPerThread]\n", argv[0]);
+        return 1;
+    }
+
+    // The default heap can only be set up once, so it gets an arena per thread up front
+    if (umeminit_arenas(64 << 20, algo, maxThreads) != 0) {
+        fprintf(stderr, "Could not initialize the default heap\n");
+        return 1;
+    }
+    umemgrow(0);
+
+    printf("Policy %d, %zu calls per thread, %ld cores\n", algo, callsPerThread, cores);
+    printf("%-8s", "Threads");
+    for (int c = 0; c < CONFIGS; c++) {
+        printf(" %16s", configNames[c]);
+    }
+    printf("   (calls/s)\n");
+
+    for (int threads = 1; ; threads = threads * 2 < maxThreads ? threads * 2 : maxThreads) {
+        printf("%-8d", threads);
+        for (config = 0; config < CONFIGS; config++) {
+            double rate = run(threads, algo);
+            if (rate < 0) {
+                printf(" %16s", "failed");
+            } else {
+                printf(" %16.0f", rate);
+            }
+            fflush(stdout);
+        }
+        printf("\n");
+        if (threads == maxThreads) {
+            break;
+        }
+    }
+    return 0;
+}
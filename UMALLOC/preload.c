@@ -0,0 +1,163 @@
+// Drop-in replacement for the C library allocator, so unmodified programs
+// run on umem:
+//
+//   gcc -O2 -shared -fPIC -ftls-model=initial-exec -DUMEM_THREADSAFE -pthread
+//       -o libumem.so preload.c umem.c
+//   UMEM_POLICY=TLSF LD_PRELOAD=./libumem.so ls -l
+//
+// The default heap is set up on the first call, from the environment:
+//   UMEM_POLICY     BEST_FIT, WORST_FIT, FIRST_FIT, NEXT_FIT, BUDDY or TLSF,
+//                   or the policy's number (TLSF if unset)
+//   UMEM_HEAP_SIZE  initial region in bytes (64 MB if unset); the heap grows
+//                   as needed except under BUDDY, whose region has to be big
+//                   enough for the whole program
+//   UMEM_ARENAS     arena count (one per online CPU, at most 64, if unset)
+//   UMEM_TRACE      if set, a file to record the program's calls to, for replay
+//   UMEM_HUGE_PAGES if set to anything but 0, back the heap with 2 MB pages
+//
+// Nothing here may call malloc itself: the environment is read with getenv
+// and the heap comes straight from mmap. Locks are not reset across fork,
+// so a child forked while another thread is inside the allocator may hang.
+#include "umem.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#ifndef UMEM_THREADSAFE
+#error "preload.c must be built with -DUMEM_THREADSAFE -pthread, like umem.c, to serve threaded programs"
+#endif
+
+#define DEFAULT_HEAP_SIZE (64 << 20)
+#define EXPORT __attribute__((visibility("default")))
+
+static pthread_once_t initOnce = PTHREAD_ONCE_INIT;
+static int ready = 0;  // Set once the default heap exists
+
+static const char *policyNames[] = {"BEST_FIT", "WORST_FIT", "FIRST_FIT", "NEXT_FIT", "BUDDY", "TLSF"};
+
+static int policyFromEnv(void) {
+    const char *value = getenv("UMEM_POLICY");
+    if (value == NULL || *value == '\0') {
+        return TLSF;
+    }
+    for (int i = 0; i < 6; i++) {
+        if (strcasecmp(value, policyNames[i]) == 0) {
+            return BEST_FIT + i;
+        }
+    }
+    int algo = atoi(value);
+    return algo >= BEST_FIT && algo <= TLSF ? algo : TLSF;
+}
+
+static void initHeap(void) {
+    const char *value = getenv("UMEM_HEAP_SIZE");
+    size_t size = value ? strtoul(value, NULL, 0) : 0;
+    if (size == 0) {
+        size = DEFAULT_HEAP_SIZE;
+    }
+
+    value = getenv("UMEM_ARENAS");
+    long arenas = value ? atol(value) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (arenas < 1) {
+        arenas = 1;
+    }
+    if (arenas > 64) {
+        arenas = 64;
+    }
+
+    value = getenv("UMEM_HUGE_PAGES");
+    int flags = value != NULL && *value != '\0' && strcmp(value, "0") != 0 ? UMEM_HUGE_PAGES : 0;
+
+    if (umeminit_flags(size, policyFromEnv(), (int)arenas, flags) != 0) {
+        return;  // Every allocation will fail with ENOMEM
+    }
+    umemgrow(0);  // Refused under BUDDY, which keeps its fixed region
+
+    value = getenv("UMEM_TRACE");
+    if (value != NULL && *value != '\0') {
+        umemtrace_start(value);
+    }
+    __atomic_store_n(&ready, 1, __ATOMIC_RELEASE);
+}
+
+static inline int heapReady(void) {
+    if (!__atomic_load_n(&ready, __ATOMIC_ACQUIRE)) {
+        pthread_once(&initOnce, initHeap);
+    }
+    return __atomic_load_n(&ready, __ATOMIC_ACQUIRE);
+}
+
+EXPORT void *malloc(size_t size) {
+    void *ptr = heapReady() ? umalloc(size) : NULL;
+    if (ptr == NULL) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+EXPORT void free(void *ptr) {
+    if (ptr != NULL) {
+        ufree(ptr);
+    }
+}
+
+EXPORT void *calloc(size_t count, size_t size) {
+    if (size != 0 && count > (size_t)-1 / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    // umalloc, not malloc: the compiler may turn malloc plus memset into a call to calloc
+    void *ptr = heapReady() ? umalloc(count * size) : NULL;
+    if (ptr == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(ptr, 0, count * size);  // Freed blocks are reused as they are
+    return ptr;
+}
+
+EXPORT void *realloc(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return malloc(size);
+    }
+    void *moved = urealloc(ptr, size);
+    if (moved == NULL && size != 0) {
+        errno = ENOMEM;
+    }
+    return moved;
+}
+
+EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (!heapReady()) {
+        return ENOMEM;
+    }
+    return uposix_memalign(memptr, alignment, size);
+}
+
+EXPORT void *aligned_alloc(size_t alignment, size_t size) {
+    void *ptr = heapReady() ? ualigned_alloc(alignment, size) : NULL;
+    if (ptr == NULL) {
+        errno = (alignment & (alignment - 1)) != 0 ? EINVAL : ENOMEM;
+    }
+    return ptr;
+}
+
+EXPORT void *memalign(size_t alignment, size_t size) {
+    return aligned_alloc(alignment, size);
+}
+
+EXPORT void *valloc(size_t size) {
+    return aligned_alloc(getpagesize(), size);
+}
+
+EXPORT void *pvalloc(size_t size) {
+    size_t pageSize = getpagesize();
+    return aligned_alloc(pageSize, (size + pageSize - 1) & ~(pageSize - 1));
+}
+
+EXPORT size_t malloc_usable_size(void *ptr) {
+    return umalloc_usable_size(ptr);
+}
@@ -0,0 +1,295 @@
+// Replays a trace recorded with umemtrace_start against every allocation
+// policy and reports, per policy, how fast the calls ran, how much memory the
+// heap needed and how fragmented it was at its fullest.
+//
+// Build: gcc -O2 -o replay replay.c umem.c
+// Usage: ./replay trace.bin [initialHeapBytes]
+//
+// Each policy gets a fresh heap of its own (64 MB unless given). Heaps that
+// can grow are allowed to, so with a small initial size the peak mapped size
+// shows how far each policy had to grow; BUDDY cannot, so a trace that
+// outgrows it reports failed calls instead. Every request goes through the
+// policy: the mmap threshold and page release are turned off.
+#include "umem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define EMPTY_SLOT ((size_t)-1)
+
+// One trace record with its block addresses turned into dense slot numbers
+typedef struct {
+    int op;          // UMEM_TRACE_*, or 0 for a call that changed nothing
+    size_t size;
+    size_t slot;     // Slot of the block returned (or freed), EMPTY_SLOT if none
+    size_t oldSlot;  // UMEM_TRACE_REALLOC: slot of the block passed in
+} op_t;
+
+// Open addressing map from recorded address to slot, used once while loading
+typedef struct {
+    uint64_t *keys;
+    size_t *values;
+    size_t capacity;
+    size_t count;
+} idmap_t;
+
+static const char *policyNames[] = {"", "BEST_FIT", "WORST_FIT", "FIRST_FIT", "NEXT_FIT", "BUDDY", "TLSF"};
+
+static size_t idHash(uint64_t id, size_t capacity) {
+    return (size_t)((id >> 4) * 0x9E3779B97F4A7C15ULL) & (capacity - 1);
+}
+
+static void idmapPut(idmap_t *map, uint64_t id, size_t slot);
+
+static void idmapGrow(idmap_t *map) {
+    idmap_t bigger = {0};
+    bigger.capacity = map->capacity ? map->capacity * 2 : 1024;
+    bigger.keys = calloc(bigger.capacity, sizeof(uint64_t));
+    bigger.values = malloc(bigger.capacity * sizeof(size_t));
+    if (bigger.keys == NULL || bigger.values == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->keys[i] != 0 && map->values[i] != EMPTY_SLOT) {
+            idmapPut(&bigger, map->keys[i], map->values[i]);
+        }
+    }
+    free(map->keys);
+    free(map->values);
+    *map = bigger;
+}
+
+// A value of EMPTY_SLOT marks a deleted entry
+static void idmapPut(idmap_t *map, uint64_t id, size_t slot) {
+    if ((map->count + 1) * 2 > map->capacity) {
+        idmapGrow(map);
+    }
+    size_t i = idHash(id, map->capacity);
+    while (map->keys[i] != 0 && map->keys[i] != id) {
+        i = (i + 1) & (map->capacity - 1);
+    }
+    if (map->keys[i] == 0) {
+        map->keys[i] = id;
+        map->count++;
+    }
+    map->values[i] = slot;
+}
+
+static size_t idmapTake(idmap_t *map, uint64_t id) {
+    if (id == 0 || map->capacity == 0) {
+        return EMPTY_SLOT;
+    }
+    size_t i = idHash(id, map->capacity);
+    while (map->keys[i] != 0) {
+        if (map->keys[i] == id) {
+            size_t slot = map->values[i];
+            map->values[i] = EMPTY_SLOT;
+            return slot;
+        }
+        i = (i + 1) & (map->capacity - 1);
+    }
+    return EMPTY_SLOT;
+}
+
+// Read a trace and number its blocks so replaying needs no lookups. Slots of
+// freed blocks are reused, which keeps the pointer table as small as the
+// trace's peak number of live blocks. Frees of blocks the trace never
+// allocated are dropped and counted in skipped.
+static op_t *loadTrace(const char *path, size_t *opCount, size_t *slotCount, size_t *skipped) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return NULL;
+    }
+
+    char tag[8];
+    if (fread(tag, 1, 8, file) != 8 || memcmp(tag, "UMTRACE1", 8) != 0) {
+        fprintf(stderr, "%s is not a umem trace\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    size_t count = (ftell(file) - 8) / sizeof(umem_trace_record_t);
+    fseek(file, 8, SEEK_SET);
+
+    umem_trace_record_t *records = malloc(count * sizeof(umem_trace_record_t) + 1);
+    op_t *ops = malloc(count * sizeof(op_t) + 1);
+    size_t *freeSlots = malloc(count * sizeof(size_t) + 1);
+    if (records == NULL || ops == NULL || freeSlots == NULL || fread(records, sizeof(umem_trace_record_t), count, file) != count) {
+        fprintf(stderr, "Could not read %s\n", path);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+
+    idmap_t map = {0};
+    size_t slots = 0, freeCount = 0;
+    *skipped = 0;
+    for (size_t i = 0; i < count; i++) {
+        ops[i].op = (int)(records[i].stamp >> UMEM_TRACE_OP_SHIFT);
+        ops[i].size = records[i].size;
+        ops[i].oldSlot = EMPTY_SLOT;
+        ops[i].slot = EMPTY_SLOT;
+
+        if (ops[i].op == UMEM_TRACE_FREE) {
+            ops[i].slot = idmapTake(&map, records[i].id);
+            if (ops[i].slot != EMPTY_SLOT) {
+                freeSlots[freeCount++] = ops[i].slot;
+            } else if (records[i].id != 0) {
+                (*skipped)++;
+            }
+            continue;
+        }
+
+        if (ops[i].op == UMEM_TRACE_REALLOC) {
+            ops[i].oldSlot = idmapTake(&map, records[i].oldId);
+            if (records[i].id == 0 && records[i].size != 0 && ops[i].oldSlot != EMPTY_SLOT) {
+                idmapPut(&map, records[i].oldId, ops[i].oldSlot);  // Failed; the old block lives on
+                ops[i].op = 0;
+                continue;
+            }
+            if (ops[i].oldSlot != EMPTY_SLOT) {
+                freeSlots[freeCount++] = ops[i].oldSlot;
+            }
+        }
+        if (records[i].id != 0) {
+            ops[i].slot = freeCount ? freeSlots[--freeCount] : slots++;
+            idmapPut(&map, records[i].id, ops[i].slot);
+        }
+    }
+
+    free(map.keys);
+    free(map.values);
+    free(freeSlots);
+    free(records);
+    *opCount = count;
+    *slotCount = slots;
+    return ops;
+}
+
+static double seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static umem_heap_t *replayHeap(int algo, size_t heapSize) {
+    umem_heap_t *heap = umem_heap_create(heapSize, algo, 1);
+    if (heap != NULL) {
+        umem_heap_grow(heap, 0);  // Refused by BUDDY, which keeps its fixed size
+        umem_heap_set_mmap_threshold(heap, 0);
+        umem_heap_set_decay(heap, 0, 0);
+    }
+    return heap;
+}
+
+// Run every op against heap. With stats set, a snapshot follows each op to
+// track the peaks; that pass is not timed. Returns the calls that failed.
+static size_t replay(umem_heap_t *heap, op_t *ops, size_t count, void **table, umem_stats_t *peak, double *fragmentation) {
+    size_t failures = 0;
+    umem_stats_t stats;
+
+    for (size_t i = 0; i < count; i++) {
+        op_t *op = &ops[i];
+        switch (op->op) {
+            case UMEM_TRACE_MALLOC:
+                if (op->slot != EMPTY_SLOT && (table[op->slot] = umalloc_from(heap, op->size)) == NULL) {
+                    failures++;
+                }
+                break;
+            case UMEM_TRACE_REALLOC: {
+                void *old = op->oldSlot != EMPTY_SLOT ? table[op->oldSlot] : NULL;
+                if (op->oldSlot != EMPTY_SLOT) {
+                    table[op->oldSlot] = NULL;
+                }
+                void *moved = urealloc_from(heap, old, op->size);
+                if (moved == NULL && op->size != 0) {
+                    moved = old;  // Still allocated; later calls on the new block use it
+                    failures++;
+                }
+                if (op->slot != EMPTY_SLOT) {
+                    table[op->slot] = moved;
+                }
+                break;
+            }
+            case UMEM_TRACE_FREE:
+                if (op->slot != EMPTY_SLOT) {
+                    ufree_to(heap, table[op->slot]);
+                    table[op->slot] = NULL;
+                }
+                break;
+        }
+
+        if (peak != NULL) {
+            umemsnapshot_from(heap, &stats);
+            if (stats.mapped > peak->mapped) {
+                peak->mapped = stats.mapped;
+            }
+            if (stats.allocated > peak->allocated) {
+                peak->allocated = stats.allocated;
+                // External fragmentation: the share of free memory outside the largest free block
+                *fragmentation = stats.freeBytes ? 100.0 * (stats.freeBytes - stats.largestFree) / stats.freeBytes : 0;
+            }
+        }
+    }
+    return failures;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s trace.bin [initialHeapBytes]\n", argv[0]);
+        return 1;
+    }
+    size_t heapSize = argc > 2 ? strtoul(argv[2], NULL, 0) : 64 << 20;
+
+    size_t count, slots, skipped;
+    op_t *ops = loadTrace(argv[1], &count, &slots, &skipped);
+    if (ops == NULL) {
+        return 1;
+    }
+    void **table = calloc(slots + 1, sizeof(void *));
+    if (table == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    printf("%zu calls, at most %zu blocks live at once\n", count, slots);
+    if (skipped) {
+        printf("%zu frees of blocks the trace never allocated are skipped\n", skipped);
+    }
+    printf("\n");
+
+    printf("%-10s %14s %14s %14s %15s %9s\n", "Policy", "Calls/s", "Peak mapped", "Peak in use", "Fragmentation", "Failed");
+    for (int algo = BEST_FIT; algo <= TLSF; algo++) {
+        umem_heap_t *heap = replayHeap(algo, heapSize);
+        if (heap == NULL) {
+            printf("%-10s could not create a %zu-byte heap\n", policyNames[algo], heapSize);
+            continue;
+        }
+        double start = seconds();
+        size_t failures = replay(heap, ops, count, table, NULL, NULL);
+        double elapsed = seconds() - start;
+        umem_heap_destroy(heap);
+
+        umem_stats_t peak = {0};
+        double fragmentation = 0;
+        memset(table, 0, (slots + 1) * sizeof(void *));
+        heap = replayHeap(algo, heapSize);
+        if (heap == NULL) {
+            printf("%-10s could not create a %zu-byte heap\n", policyNames[algo], heapSize);
+            continue;
+        }
+        replay(heap, ops, count, table, &peak, &fragmentation);
+        umem_heap_destroy(heap);
+        memset(table, 0, (slots + 1) * sizeof(void *));
+
+        printf("%-10s %14.0f %14zu %14zu %14.2f%% %9zu\n", policyNames[algo],
+               elapsed > 0 ? count / elapsed : 0, peak.mapped, peak.allocated, fragmentation, failures);
+    }
+
+    free(table);
+    free(ops);
+    return 0;
+}
@@ -1,338 +1,3261 @@
-#include "umem.h"      // Include header file for allocator definitions
-#include <stdio.h>     // For I/O
-#include <stdlib.h>    // For exit (in case of memory corruption)
-#include <string.h>    // For memcpy
-#include <sys/mman.h>  // For mmap and associated memory management constants
-#include <unistd.h>    // For getpagesize
-
-// Global Variable initialization
-void *base_ptr = NULL; // Base pointer for the heap
-int allocAlgo = 0;
-size_t heapSize = 0;
-node_t *freeList = NULL;
-static node_t *lastAlloc = NULL;  // For NEXT FIT
-size_t total_allocations = 0;     // Tracks total number of allocations
-size_t total_deallocations = 0;   // Tracks total number of deallocations
-size_t allocated_memory = 0;      // Keeps track of allocated memory
-
-const int ALIGNMENT = 8;  // 8-byte alignment constant for allocations
-
-// Prototypes for helper functions
-void *best_fit(size_t size);
-void *worst_fit(size_t size);
-void *first_fit(size_t size);
-void *next_fit(size_t size);
-void blockAllocated(void *block, size_t size);
-void addToFreeList(node_t *block);
-void coalesce();
-size_t calculateFragmentation();
-
-
-int umeminit(size_t sizeOfRegion, int allocationAlgo) {
-    if (base_ptr != NULL || sizeOfRegion <= 0) {
-        return -1;  // Return failure if already initialized
-    }
-    
-    // getting system page size and rounding it
-    size_t pageSize = getpagesize();
-    sizeOfRegion = ((sizeOfRegion + pageSize - 1) / pageSize) * pageSize;
-
-    // Request memory using mmap
-    base_ptr = mmap(NULL, sizeOfRegion, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (base_ptr == MAP_FAILED) {
-        perror("mmap");
-        exit(1);
-    }
-
-    allocAlgo = allocationAlgo; // Set global allocation algorithm
-    heapSize = sizeOfRegion;     // Set global heap size
-
-    // Initialize the free list to cover the entire region
-    freeList = (node_t *)base_ptr;
-    freeList->size = sizeOfRegion - sizeof(header_t); // Take space for header
-    freeList->next = NULL; 
-
-    return 0;
-}
-
-void *umalloc(size_t size) {
-    if (base_ptr == NULL) {
-        return NULL;  // Ensure umeminit() is called first
-    }
-
-    // Align requested size to 8 bytes and add header size
-    size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
-    size += sizeof(header_t);  // Include header size in allocation
-
-    void *allocated_block = NULL;
-    node_t *prev = NULL, *current = freeList;
-    
-
-    switch (allocAlgo) { // Choose the algorithm to be run for the allocated size
-        case BEST_FIT:
-            allocated_block = best_fit(size);
-            break;
-        case WORST_FIT:
-            allocated_block = worst_fit(size);
-            break;
-        case FIRST_FIT:
-            allocated_block = first_fit(size);
-            break;
-        case NEXT_FIT:
-            allocated_block = next_fit(size);
-            break;
-        default:
-            fprintf(stderr, "Error: Invalid allocation algorithm.\n");
-            return NULL;
-    }
-    /* Test case to see if there is a recognized algorith
-    if (allocated_block != NULL) {
-    printf("Selected block at address: %p, with size: %zu for requested size: %zu\n", allocated_block, size, size - sizeof(header_t));
-    }
-    */
-    if (allocated_block == NULL) {
-        return NULL;  // Not enough contiguous space
-    }
-
-    // Find and split the free block
-    while (current) {
-        if ((void *)((char *)current + sizeof(header_t)) == allocated_block) {
-            if (current->size > size) {
-                node_t *new_free_block = (node_t *)((char *)current + size);
-                new_free_block->size = current->size - size;
-                new_free_block->next = current->next;
-
-                if (prev) {
-                    prev->next = new_free_block;
-                } else {
-                    freeList = new_free_block;
-                }
-            } else {
-                if (prev) {
-                    prev->next = current->next;
-                } else {
-                    freeList = current->next;
-                }
-            }
-            break;
-        }
-        prev = current;
-        current = current->next;
-    }
-
-    // Mark block as allocated and include the header size in statistics
-    blockAllocated(allocated_block, size - sizeof(header_t));
-    allocated_memory += size;  // Include the entire block size (header + size request)
-    total_allocations++;
-    return (void *)((char *)allocated_block + sizeof(header_t));  // Return pointer after header
-}
-
-int ufree(void *ptr) {
-    if (ptr == NULL) return 1;
-
-    header_t *header = (header_t *)((char *)ptr - sizeof(header_t));
-
-    if (header->magic != MAGIC) { // Validation of the magic number
-        fprintf(stderr, "Error: Memory corruption detected at block %p\n", ptr);
-        exit(1);
-    }
-
-    node_t *current = freeList;
-    while (current) {
-        if ((void *)current == (void *)header) {
-            fprintf(stderr, "Error: Double-free detected at block %p\n", ptr);
-            exit(1);
-        }
-        current = current->next;
-    }
-
-    allocated_memory -= header->size + sizeof(header_t);  // Account for entire block size
-    addToFreeList((node_t *)header);
-    coalesce();
-    total_deallocations++;
-    return 1;
-}
-
-void *urealloc(void *ptr, size_t size) {
-    if (ptr == NULL) return umalloc(size);
-    if (size == 0) {
-        ufree(ptr);
-        return NULL;
-    }
-
-    size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
-
-    header_t *header = (header_t *)((char *)ptr - sizeof(header_t));
-    if (header->magic != MAGIC) {
-        fprintf(stderr, "Error: Memory corruption detected at block %p\n", ptr);
-        exit(1);
-    }
-
-    if (header->size >= size) return ptr;
-
-    void *new_block = umalloc(size);
-    if (new_block == NULL) return NULL;
-
-    memcpy(new_block, ptr, header->size);
-    ufree(ptr);
-    return new_block;
-}
-
-void umemstats(void) {
-    size_t free_memory = heapSize - allocated_memory;  // Correctly calculate free memory
-    size_t fragmentation = calculateFragmentation();
-
-    printumemstats((int)total_allocations, 
-                   (int)total_deallocations, 
-                   (long)allocated_memory, 
-                   (long)free_memory, 
-                   (double)fragmentation);
-}
-
-void *best_fit(size_t size) {
-    node_t *best_fit = NULL;
-    node_t *current = freeList;
-
-    while (current) {
-        if (current->size >= size) {
-            if (!best_fit || current->size < best_fit->size) {
-                best_fit = current;
-            }
-        }
-        current = current->next;
-    }
-
-    return (best_fit) ? (void *)((char *)best_fit + sizeof(header_t)) : NULL;
-}
-
-void *worst_fit(size_t size) {
-    node_t *worst_fit = NULL;
-    node_t *current = freeList;
-
-    while (current) {
-        if (current->size >= size) {
-            if (!worst_fit || current->size > worst_fit->size) {
-                worst_fit = current;
-            }
-        }
-        current = current->next;
-    }
-
-    return (worst_fit) ? (void *)((char *)worst_fit + sizeof(header_t)) : NULL;
-}
-
-void *first_fit(size_t size) {
-    node_t *current = freeList;
-
-    while (current) {
-        if (current->size >= size) {
-            return (void *)((char *)current + sizeof(header_t));
-        }
-        current = current->next;
-    }
-
-    return NULL;
-}
-
-void *next_fit(size_t size) {
-    node_t *current = (lastAlloc) ? lastAlloc->next : freeList;
-
-    while (current) {
-        if (current->size >= size) {
-            lastAlloc = current;
-            return (void *)((char *)current + sizeof(header_t));
-        }
-        current = current->next;
-    }
-
-    current = freeList;
-    while (current && current != lastAlloc) {
-        if (current->size >= size) {
-            lastAlloc = current;
-            return (void *)((char *)current + sizeof(header_t));
-        }
-        current = current->next;
-    }
-
-    return NULL;
-}
-
-void blockAllocated(void *block, size_t size) {
-    header_t *header = (header_t *)block;
-    header->magic = MAGIC;
-    header->size = size;
-}
-
-void coalesce() {
-    node_t *current = freeList;
-
-    while (current && current->next) {
-        node_t *next = current->next;
-
-        // Check if current and next blocks are physically adjacent in memory
-        if ((char *)current + sizeof(header_t) + current->size == (char *)next) {
-
-            // Coalesce by combining sizes and linking to the next's next block
-            current->size += sizeof(header_t) + next->size;
-            current->next = next->next;
-        } else {
-            current = current->next;
-        }
-    }
-}
-
-
-
-void addToFreeList(node_t *block) {
-    node_t *current = freeList;
-    node_t *prev = NULL;
-
-    // Enforce 8-byte alignment for the free block
-    uintptr_t aligned_address = ((uintptr_t)block + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
-    block = (node_t *)aligned_address;
-
-    // Insert the block back into the free list sorted by address
-    while (current && current < block) {
-        prev = current;
-        current = current->next;
-    }
-
-    block->next = current;
-    if (prev) {
-        prev->next = block;
-    } else {
-        freeList = block;
-    }
-
-    coalesce();  // Coalesce adjacent free blocks to reduce fragmentation
-}
-
-size_t calculateFragmentation() {
-    size_t totalFree = 0;
-    size_t fragmentedFree = 0;
-    node_t *current = freeList;
-
-    // Find the largest free block
-    size_t largestFreeBlock = 0;
-    while (current) {
-        if (current->size > largestFreeBlock) {
-            largestFreeBlock = current->size;
-        }
-        totalFree += current->size;
-        current = current->next;
-    }
-
-    // Define small blocks as those less than half of the largest free block (as in the prompt)
-    current = freeList;
-    while (current) {
-        if (current->size < largestFreeBlock / 2) {
-            fragmentedFree += current->size;
-        }
-        current = current->next;
-    }
-
-    // Calculate fragmentation percentage
-    return (totalFree == 0) ? 0 : (fragmentedFree * 100) / totalFree; // this is a ternary operator, found on stack overflow
-}
-
-
+#define _GNU_SOURCE    // For mremap
+#include "umem.h"      // Include header file for allocator definitions
+#include <stdio.h>     // For I/O
+#include <stdlib.h>    // For exit (in case of memory corruption)
+#include <string.h>    // For memcpy
+#include <stdint.h>    // For uintptr_t and the buddy bitmap words
+#include <sys/mman.h>  // For mmap and associated memory management constants
+#include <unistd.h>    // For getpagesize
+#include <time.h>      // For the page release decay clock
+#include <errno.h>     // For uposix_memalign's error codes
+#include <fcntl.h>     // For opening trace and heap files
+#include <sys/file.h>  // For flock on heap files
+#include <sys/stat.h>  // For a heap file's size
+#ifdef UMEM_THREADSAFE
+#include <pthread.h>   // For the arena locks and per-thread cache teardown
+#endif
+
+const int ALIGNMENT = 8;  // 8-byte alignment constant for allocations
+
+// Block layout. Sizes are multiples of ALIGNMENT, which leaves the low bits of
+// header_t.size free for state. A free block repeats its size in its last word
+// (the footer), so the block after it can find its start without a list walk.
+// An allocated block's magic word carries MAGIC in its low half and the index
+// of the arena that owns it in the high half.
+#define BLOCK_ALLOC 0x1L          // The block is handed out (clear once freed)
+#define PREV_FREE   0x2L          // The physically preceding block is free
+#define BLOCK_FAST  0x4L          // Freed by the user but parked in a fastbin (BLOCK_ALLOC stays set)
+#define BLOCK_CLEAN 0x4L          // On a free block: the pages inside it went back to the OS
+#define SIZE_FLAGS  0x7L          // All bits of size reserved for state
+#ifdef UMEM_COMPACT_HEADER
+// Compact build (-DUMEM_COMPACT_HEADER): header_t is the size word alone.
+// Sizes stop at 1 TB, and the magic word's contents are packed above them,
+// with the low 16 bits of MAGIC as the check. A free block's bits above the
+// size are clear, so it never passes for a live one.
+#define SIZE_MASK   0xFFFFFFFFF8L                     // Bits of size that hold the size itself
+#define MIN_PAYLOAD 8                                 // Room for the footer once freed
+#define MAGIC_MASK  ((long)(0xFFFFUL << 48))          // Bits of the word that hold the check
+#define MAGIC_TAG   ((long)((MAGIC & 0xFFFFUL) << 48))
+#define ARENA_SHIFT 40                                // Owning arena index, above the size
+#define ARENA_MASK  0x3FUL
+#define BLOCK_MAPPED (1L << 46)   // The block has a mapping of its own, not an arena
+#define BLOCK_OFFSET (1L << 47)   // A stand-in header; size is the distance back to the real payload
+#else
+#define SIZE_MASK   (~SIZE_FLAGS) // Bits of size that hold the size itself
+#define MIN_PAYLOAD 16            // Room for the prev link and footer once freed
+#define MAGIC_MASK  0xFFFFFFFFLL  // Bits of magic that hold MAGIC
+#define MAGIC_TAG   MAGIC
+#define ARENA_SHIFT 32            // Owning arena index, above MAGIC
+#define ARENA_MASK  0xFFFFUL
+#define BLOCK_MAPPED (1L << 48)   // In magic: the block has a mapping of its own, not an arena
+#define BLOCK_OFFSET (1L << 49)   // In magic: a stand-in header; size is the distance back to the real payload
+#endif
+// Largest request taken. Half of what a header can hold, so any header,
+// alignment or page rounding added on top still fits in one and in a size_t.
+#define MAX_PAYLOAD ((size_t)SIZE_MASK >> 1)
+
+// A free block needs room for node_t's links and its footer to be indexed.
+// Smaller ones (only possible with the compact header) stay out of the free
+// structures: they are still marked free and carry a footer, so they come
+// back into use when a neighbour merges with them.
+#define LINK_PAYLOAD (sizeof(node_t) + sizeof(long) - sizeof(header_t))
+
+// Fastbins sit in front of every policy: an exact-size LIFO cache of recently
+// freed small blocks. Cached blocks stay allocated as far as the policy is
+// concerned, so they are never split or merged until a flush hands them back.
+#define FASTBIN_MAX   128         // Largest payload that is cached
+#define FASTBIN_COUNT ((FASTBIN_MAX - MIN_PAYLOAD) / 8 + 1)
+#define FASTBIN_DEPTH 64          // Blocks per bin before frees go straight to the policy
+
+typedef struct __fastnode_t {
+    header_t header;              // Left intact so the block still validates
+    struct __fastnode_t *next;    // Next cached block of the same size
+} fastnode_t;
+
+// BEST_FIT and WORST_FIT keep their free blocks in a treap ordered by
+// (size, address) instead of freeList. A node's priority is a hash of its
+// address, so the tree stays balanced in expectation without storing anything
+// beyond the two child links, which overlay node_t's next and prev.
+typedef struct __tnode_t {
+    long size;                    // Size of the free block
+    struct __tnode_t *left;       // Smaller (size, address) keys
+    struct __tnode_t *right;      // Larger (size, address) keys
+} tnode_t;
+
+// TLSF bins free blocks by a first level (power of two) and a second level
+// (TLSF_SL_COUNT linear steps inside it); one bit per non-empty list lets
+// both the search and the insert run in constant time.
+#define TLSF_SL_LOG2    4                                 // 16 second-level lists per power of two
+#define TLSF_SL_COUNT   (1 << TLSF_SL_LOG2)
+#define TLSF_FL_SHIFT   (TLSF_SL_LOG2 + 3)                // Sizes below 128 bytes share first level 0
+#define TLSF_FL_COUNT   (47 - TLSF_FL_SHIFT + 1)         // Up to 128 TB blocks
+#define TLSF_SMALL_SIZE (1UL << TLSF_FL_SHIFT)
+
+// BUDDY starts each arena with one bitmap per order (a set bit means that
+// block is free and on its order's list), followed by the blocks themselves.
+#define BUDDY_MIN_SHIFT 5         // Smallest buddy block is 32 bytes: header plus a 16 byte payload
+#define BUDDY_MAX_ORDER 47        // Enough orders for any region mmap can hand back
+
+// A heap's region is carved into arenas, each with its own free structures
+// (and lock in the thread-safe build). Threads are spread over the arenas
+// round-robin, and a block always goes back to the arena named in its header,
+// whichever thread frees it.
+#define MAX_ARENAS      64
+#define ARENA_ALIGN     64        // Arena starts sit on cache line boundaries
+
+// A heap that is allowed to grow maps extra chunks when an arena runs dry.
+// Each chunk is laid out like a small arena (one free block and a fence) and
+// belongs to the arena that mapped it; chunks double in size each time so the
+// number of mappings stays logarithmic in the peak footprint.
+typedef struct __chunk_t {
+    struct __chunk_t *next;       // Every chunk of the heap, newest first
+    struct __chunk_t *arenaNext;  // Chunks of the same arena
+    size_t size;                  // Bytes in the mapping, this struct included
+    long pad;                     // Keeps the first block 16-byte aligned
+} chunk_t;
+
+typedef struct {
+    char *base;                                           // First byte of the arena
+    size_t size;                                          // Bytes in the arena
+    int index;                                            // Position in the heap's arena table
+    int algo;                                             // The heap's allocation policy
+
+    node_t *freeList;                                     // FIRST_FIT and NEXT_FIT, sorted by address
+    node_t *lastAlloc;                                    // For NEXT FIT
+    tnode_t *sizeTree;                                    // BEST_FIT and WORST_FIT size index
+
+    uint64_t tlsfFlMap;                                   // Bit per first level with any free block
+    uint32_t tlsfSlMap[TLSF_FL_COUNT];                    // Bit per non-empty second-level list
+    node_t *tlsfLists[TLSF_FL_COUNT][TLSF_SL_COUNT];
+
+    char *buddyBase;                                      // First byte managed by the buddy allocator
+    size_t buddySize;                                     // Bytes managed by the buddy allocator
+    int buddyMaxOrder;                                    // Largest order that fits in buddySize
+    node_t *buddyLists[BUDDY_MAX_ORDER + 1];              // Free list per order
+    uint64_t *buddyMap;                                   // Free bits for every order, stored at base
+    size_t buddyMapStart[BUDDY_MAX_ORDER + 1];            // Index of the first bit of each order
+
+    fastnode_t *fastBins[FASTBIN_COUNT];
+    int fastCount[FASTBIN_COUNT];
+    size_t fastCached;                                    // Blocks held across all bins
+
+    chunk_t *chunks;                                      // Chunks mapped for this arena
+    size_t growSize;                                      // Size of the next chunk
+
+    size_t releaseThreshold;                              // Smallest free block whose pages are released, 0 for never
+    unsigned long releaseDecay;                           // Milliseconds to hold such blocks before releasing
+    unsigned long dirtySince;                             // When the oldest unreleased one appeared, 0 if none
+    size_t releasedBytes;                                 // Total bytes handed to madvise
+    size_t pageSize;                                      // Unit of page release: a base or a huge page
+
+    size_t freeBytes;                                     // Payload bytes in free blocks
+    size_t freeBlocks;                                    // Blocks in the free structures
+    size_t freeClasses[UMEM_SIZE_CLASSES];                // ... per power-of-two size class
+    size_t largestFree;                                   // FIRST_FIT and NEXT_FIT: biggest free block
+    int largestStale;                                     // ... unless it has since been taken
+    size_t listCount[TLSF_FL_COUNT][TLSF_SL_COUNT];       // ... free blocks per TLSF list size range
+    size_t listBytes[TLSF_FL_COUNT][TLSF_SL_COUNT];       // ... and their payload bytes
+
+#ifdef UMEM_THREADSAFE
+    pthread_mutex_t lock;
+    size_t lockAcquisitions;                              // Times the slow path took this lock
+    size_t lockContentions;                               // ... and found it already held
+#endif
+} arena_t;
+
+// Free blocks of at least RELEASE_THRESHOLD bytes return their pages to the
+// OS once their arena has held them for RELEASE_DECAY_MS
+#define RELEASE_THRESHOLD (64 * 1024)
+#define RELEASE_DECAY_MS  1000
+
+// Requests of MMAP_THRESHOLD bytes or more skip the arenas and get a mapping
+// of their own, which ufree unmaps and urealloc resizes with mremap. The
+// mapping starts with this record; the block's header is its last field.
+#define MMAP_THRESHOLD (128 * 1024)
+
+// With UMEM_HUGE_PAGES the region and every chunk are multiples of
+// HUGE_PAGE_SIZE, mapped with MAP_HUGETLB if the kernel has huge pages
+// reserved, or else aligned to HUGE_PAGE_SIZE and marked MADV_HUGEPAGE so
+// transparent huge pages can back them.
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+typedef struct __mapped_t {
+    struct __mapped_t *next;      // The heap's mapped blocks, in no order
+    struct __mapped_t *prev;
+    umem_heap_t *heap;            // Owner, for ufree_to's check
+    size_t size;                  // Bytes in the mapping
+    header_t header;              // Size and magic of the block itself
+} mapped_t;
+
+// A heap owns one region and every arena in it. The struct and its arena
+// table share a small mapping of their own, so a small region keeps every byte
+// for blocks.
+struct __umem_heap_t {
+    char *base;                       // Base pointer for the heap
+    size_t size;                      // Bytes in the region
+    int algo;                         // Allocation policy
+    size_t total_allocations;         // Tracks total number of allocations
+    size_t total_deallocations;       // Tracks total number of deallocations
+    size_t allocated_memory;          // Keeps track of allocated memory
+    size_t mapSize;                   // Bytes in this struct's own mapping
+    int growable;                     // Map more chunks instead of failing
+    size_t limit;                     // Cap on mapped, 0 for none
+    size_t mapped;                    // Region plus chunks, in bytes
+    chunk_t *chunks;                  // Every chunk, for ownership checks
+    size_t mmapThreshold;             // Smallest request given its own mapping, 0 for never
+    mapped_t *largeBlocks;            // Every mapped block, so destroy can unmap them
+    int hugePages;                    // Back the region and chunks with huge pages
+    int pageBacking;                  // UMEM_PAGES_*: the weakest backing any of them got
+    struct __persist_t *file;         // Start of the heap's file, NULL unless from umem_heap_open
+    int fd;                           // ... and this process's descriptor for it
+#ifdef UMEM_THREADSAFE
+    pthread_mutex_t largeLock;        // Guards largeBlocks
+#endif
+    int arenaCount;
+    arena_t arenas[];                 // One entry per arena
+};
+
+// A heap kept in a file starts the file with this record, followed by the
+// heap struct with its arenas and then, page aligned, the region. Everything
+// in the file, free structures included, holds plain pointers, so it is only
+// ever mapped back at the address it was created at.
+#define FILE_TAG    "UMHEAP1"
+#define FILE_HEAP   64            // Offset of the heap struct, a cache line in
+#define FILE_LAYOUT (((uint64_t)sizeof(header_t) << 48) | ((uint64_t)sizeof(umem_heap_t) << 32) | sizeof(arena_t))
+
+typedef struct __persist_t {
+    char tag[8];                  // FILE_TAG, written last when the file is made
+    uint64_t layout;              // FILE_LAYOUT of the build that made it
+    char *address;                // Where the file is mapped
+    size_t fileSize;              // Bytes in the file
+    int clean;                    // The last process to use it detached normally
+    void *root;                   // The application's way back into its data
+} persist_t;
+
+static umem_heap_t *defaultHeap = NULL;  // Behind umeminit, umalloc, ufree and friends
+
+#ifdef UMEM_THREADSAFE
+// Thread-safe build (-DUMEM_THREADSAFE). Arena state is only touched under
+// the arena's lock. Each thread also keeps a private cache of the default
+// heap's blocks in the fastbin size classes; umalloc and ufree serve those
+// without any lock and only lock an arena to refill an empty class or drain a
+// full one. Heaps from umem_heap_create are not cached, so destroying one
+// never leaves blocks behind in another thread's cache. Cached
+// blocks keep their header untouched (another thread may be flipping
+// PREV_FREE under the lock), so they are tagged with the owning cache in
+// their second payload word.
+#define TCACHE_DEPTH 32           // Blocks per size class in each thread's cache
+#define TCACHE_BATCH 8            // Blocks moved per refill or drain
+
+typedef struct {
+    fastnode_t *bins[FASTBIN_COUNT];
+    int count[FASTBIN_COUNT];
+    int registered;               // Drain hook installed for this thread
+} tcache_t;
+
+typedef struct {
+    fastnode_t node;              // Header and next link, as in a fastbin
+    void *owner;                  // The caching thread's tcache while cached
+} tcnode_t;
+
+#define TCACHE_MIN (sizeof(tcnode_t) - sizeof(header_t))  // Smaller blocks (compact header) have no room for owner
+
+static pthread_key_t tcacheKey;
+static pthread_once_t tcacheOnce = PTHREAD_ONCE_INIT;
+static __thread tcache_t tcache;
+static __thread unsigned threadSlot = 0;  // 1 + this thread's round-robin number
+static unsigned nextThreadSlot = 0;
+
+// The one header field that changes under its owner's feet is PREV_FREE, set
+// or cleared when a neighbour is freed or reused under the lock. Header words
+// are therefore read, and those bits flipped, with relaxed atomics.
+#define LOAD_SIZE(h)        __atomic_load_n(&(h)->size, __ATOMIC_RELAXED)
+#define SET_BITS(h, bits)   __atomic_fetch_or(&(h)->size, (bits), __ATOMIC_RELAXED)
+#define CLEAR_BITS(h, bits) __atomic_fetch_and(&(h)->size, ~(bits), __ATOMIC_RELAXED)
+#define STAT_ADD(var, n)    __atomic_fetch_add(&(var), (n), __ATOMIC_RELAXED)
+#define STAT_GET(var)       __atomic_load_n(&(var), __ATOMIC_RELAXED)
+#define ARENA_LOCK(a)       arenaLock(a)
+#define ARENA_UNLOCK(a)     pthread_mutex_unlock(&(a)->lock)
+#define LARGE_LOCK(heap)    pthread_mutex_lock(&(heap)->largeLock)
+#define LARGE_UNLOCK(heap)  pthread_mutex_unlock(&(heap)->largeLock)
+#else
+#define LOAD_SIZE(h)        ((h)->size)
+#define SET_BITS(h, bits)   ((h)->size |= (bits))
+#define CLEAR_BITS(h, bits) ((h)->size &= ~(bits))
+#define STAT_ADD(var, n)    ((var) += (n))
+#define STAT_GET(var)       (var)
+#define ARENA_LOCK(a)
+#define ARENA_UNLOCK(a)
+#define LARGE_LOCK(heap)
+#define LARGE_UNLOCK(heap)
+#define tcachePop(size)       NULL
+#define tcachePush(header)    0
+#define tcacheRefill(a, size)
+#endif
+
+// Prototypes for helper functions
+node_t *best_fit(arena_t *a, size_t size);
+node_t *worst_fit(arena_t *a, size_t size);
+node_t *first_fit(arena_t *a, size_t size);
+node_t *next_fit(arena_t *a, size_t size);
+node_t *tlsf_fit(arena_t *a, size_t size);
+int buddy_init(arena_t *a);
+size_t buddy_payload(arena_t *a, size_t size);
+header_t *buddy_alloc(arena_t *a, size_t size);
+int buddy_free(arena_t *a, header_t *header, void *ptr);
+int buddy_resize(arena_t *a, header_t *header, size_t size);
+void blockAllocated(arena_t *a, void *block, size_t size);
+void splitBlock(arena_t *a, node_t *block, size_t size);
+void freeInsert(arena_t *a, node_t *block);
+void addToFreeList(arena_t *a, node_t *block);
+int resizeBlock(arena_t *a, header_t *header, size_t size);
+header_t *heapAlloc(arena_t *a, size_t size);
+header_t *alignedBlock(arena_t *a, size_t size, size_t alignment);
+static header_t *arenasAlloc(umem_heap_t *heap, arena_t *home, size_t size, size_t alignment, int refill);
+header_t *allocBlock(arena_t *a, size_t size);
+void heapFree(arena_t *a, header_t *header);
+void releaseBlock(arena_t *a, header_t *header);
+void fastbinFlush(arena_t *a);
+size_t calculateFragmentation(umem_heap_t *heap);
+void arenaDecay(arena_t *a, node_t *block);
+static long mergeClean(arena_t *a, char *first, char *second, char *end, long firstClean, long secondClean);
+void arenaTick(arena_t *a);
+void arenaPurge(arena_t *a, size_t minSize);
+static size_t arenaLargest(arena_t *a);
+static int heapLayout(umem_heap_t *heap, char *base, size_t sizeOfRegion, int allocationAlgo, int arenaCount);
+static void fileDetach(umem_heap_t *heap);
+static int tracing(void);
+static void traceRecord(int op, size_t size, void *id, void *oldId);
+static void traceLock(void);
+static void traceUnlock(void);
+static void traceWrite(int op, size_t size, void *id, void *oldId);
+
+// Block helpers shared by the list based policies
+static inline size_t blockSize(void *block) {
+    return LOAD_SIZE((header_t *)block) & SIZE_MASK;
+}
+
+static inline header_t *nextBlock(void *block) {
+    return (header_t *)((char *)block + sizeof(header_t) + blockSize(block));
+}
+
+static inline void setFooter(node_t *block) {
+    *(long *)((char *)nextBlock(block) - sizeof(long)) = blockSize(block);
+}
+
+static inline int isFree(header_t *block) {
+    return !(LOAD_SIZE(block) & BLOCK_ALLOC);
+}
+
+// The word that holds MAGIC, the owning arena and BLOCK_MAPPED or BLOCK_OFFSET
+static inline long magicWord(header_t *block) {
+#ifdef UMEM_COMPACT_HEADER
+    return LOAD_SIZE(block);
+#else
+    return block->magic;
+#endif
+}
+
+// Stamp MAGIC and owner (a shifted arena index, BLOCK_MAPPED or BLOCK_OFFSET)
+// on a block whose size is already set
+static inline void setMagic(header_t *block, long owner) {
+#ifdef UMEM_COMPACT_HEADER
+    block->size = (block->size & (SIZE_MASK | SIZE_FLAGS)) | MAGIC_TAG | owner;
+#else
+    block->magic = MAGIC_TAG | owner;
+#endif
+}
+
+// Whether block lies in the heap's region or one of its chunks. Chunks are
+// only ever prepended, so the list can be walked without a lock.
+static int heapContains(umem_heap_t *heap, header_t *block) {
+    if ((char *)block >= heap->base && (char *)block < heap->base + heap->size) {
+        return 1;
+    }
+    for (chunk_t *chunk = __atomic_load_n(&heap->chunks, __ATOMIC_ACQUIRE); chunk; chunk = chunk->next) {
+        if ((char *)block >= (char *)chunk && (char *)block < (char *)chunk + chunk->size) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static inline mapped_t *mappedOf(header_t *block) {
+    return (mapped_t *)((char *)block - offsetof(mapped_t, header));
+}
+
+// A live block of this heap: MAGIC in the magic word, and either a mapping
+// the heap owns or a place inside its memory and an arena index that exists
+static inline int validMagic(umem_heap_t *heap, header_t *block) {
+    long magic = magicWord(block);
+    if ((magic & MAGIC_MASK) != MAGIC_TAG) {
+        return 0;
+    }
+    if (magic & BLOCK_MAPPED) {
+        return mappedOf(block)->heap == heap;
+    }
+    return heapContains(heap, block) &&
+           (((unsigned long)magic >> ARENA_SHIFT) & ARENA_MASK) < (unsigned long)heap->arenaCount;
+}
+
+static inline arena_t *arenaOf(umem_heap_t *heap, header_t *block) {
+    return &heap->arenas[((unsigned long)magicWord(block) >> ARENA_SHIFT) & ARENA_MASK];
+}
+
+// Whether the thread caches front this heap: only the default heap, and only
+// if it is not kept in a file, where cached blocks would outlive the threads
+static inline int threadCached(umem_heap_t *heap) {
+    return heap == defaultHeap && heap->file == NULL;
+}
+
+// Arena for the calling thread's requests
+static arena_t *pickArena(umem_heap_t *heap) {
+#ifdef UMEM_THREADSAFE
+    if (threadSlot == 0) {
+        threadSlot = __atomic_add_fetch(&nextThreadSlot, 1, __ATOMIC_RELAXED);
+    }
+    return &heap->arenas[(threadSlot - 1) % heap->arenaCount];
+#else
+    return &heap->arenas[0];
+#endif
+}
+
+// Fastbin helpers. A block is only reused for a request of exactly its size.
+static header_t *fastbinPop(arena_t *a, size_t size) {
+    if (size > FASTBIN_MAX) {
+        return NULL;
+    }
+
+    int bin = (size - MIN_PAYLOAD) / 8;
+    fastnode_t *block = a->fastBins[bin];
+    if (block == NULL) {
+        return NULL;
+    }
+
+    a->fastBins[bin] = block->next;
+    a->fastCount[bin]--;
+    a->fastCached--;
+    CLEAR_BITS(&block->header, BLOCK_FAST);
+    return &block->header;
+}
+
+static int fastbinPush(arena_t *a, header_t *header) {
+    size_t size = blockSize(header);
+    if (size > FASTBIN_MAX) {
+        return 0;
+    }
+
+    int bin = (size - MIN_PAYLOAD) / 8;
+    if (a->fastCount[bin] >= FASTBIN_DEPTH) {
+        return 0;  // Bin is full; let the policy have it, even if too small to index
+    }
+
+    fastnode_t *block = (fastnode_t *)header;
+    SET_BITS(header, BLOCK_FAST);
+    block->next = a->fastBins[bin];
+    a->fastBins[bin] = block;
+    a->fastCount[bin]++;
+    a->fastCached++;
+    return 1;
+}
+
+#ifdef UMEM_THREADSAFE
+static void arenaLock(arena_t *a) {
+    if (pthread_mutex_trylock(&a->lock) != 0) {
+        STAT_ADD(a->lockContentions, 1);
+        pthread_mutex_lock(&a->lock);
+    }
+    a->lockAcquisitions++;
+}
+
+// Return a cached block to the arena that owns it. held is the arena whose
+// lock the caller has (or NULL); the new one is returned, still locked.
+static arena_t *tcacheRelease(arena_t *held, header_t *header) {
+    arena_t *a = arenaOf(defaultHeap, header);
+    if (a != held) {
+        if (held) {
+            ARENA_UNLOCK(held);
+        }
+        ARENA_LOCK(a);
+    }
+    heapFree(a, header);
+    return a;
+}
+
+// Thread exit hook: give everything still cached back to the default heap
+static void tcacheDrainAll(void *arg) {
+    tcache_t *cache = (tcache_t *)arg;
+    arena_t *held = NULL;
+
+    for (int bin = 0; bin < FASTBIN_COUNT; bin++) {
+        while (cache->bins[bin]) {
+            fastnode_t *block = cache->bins[bin];
+            cache->bins[bin] = block->next;
+            held = tcacheRelease(held, &block->header);
+        }
+        cache->count[bin] = 0;
+    }
+    if (held) {
+        ARENA_UNLOCK(held);
+    }
+}
+
+static void tcacheCreateKey(void) {
+    pthread_key_create(&tcacheKey, tcacheDrainAll);
+}
+
+static void tcacheAdd(header_t *header) {
+    int bin = (blockSize(header) - MIN_PAYLOAD) / 8;
+    tcnode_t *block = (tcnode_t *)header;
+
+    if (!tcache.registered) {
+        pthread_once(&tcacheOnce, tcacheCreateKey);
+        pthread_setspecific(tcacheKey, &tcache);
+        tcache.registered = 1;
+    }
+
+    block->owner = &tcache;
+    block->node.next = tcache.bins[bin];
+    tcache.bins[bin] = &block->node;
+    tcache.count[bin]++;
+}
+
+static header_t *tcachePop(size_t size) {
+    if (size > FASTBIN_MAX || size < TCACHE_MIN) {
+        return NULL;
+    }
+
+    int bin = (size - MIN_PAYLOAD) / 8;
+    tcnode_t *block = (tcnode_t *)tcache.bins[bin];
+    if (block == NULL) {
+        return NULL;
+    }
+
+    tcache.bins[bin] = block->node.next;
+    tcache.count[bin]--;
+    block->owner = NULL;
+    return &block->node.header;
+}
+
+// Called with the arena lock held after a miss: stock the class for the next few requests
+static void tcacheRefill(arena_t *a, size_t size) {
+    if (size > FASTBIN_MAX || size < TCACHE_MIN) {
+        return;
+    }
+
+    int bin = (size - MIN_PAYLOAD) / 8;
+    for (int i = 1; i < TCACHE_BATCH && tcache.count[bin] < TCACHE_DEPTH; i++) {
+        header_t *header = fastbinPop(a, size);
+        if (header == NULL) {
+            header = allocBlock(a, size);
+        }
+        if (header == NULL) {
+            return;
+        }
+        if (blockSize(header) != size) {
+            releaseBlock(a, header);  // Came with an unsplittable tail; it belongs to another class
+            return;
+        }
+        tcacheAdd(header);
+    }
+}
+
+// Cache a freed block; when its class is full, move a batch back under the lock
+static int tcachePush(header_t *header) {
+    size_t size = blockSize(header);
+    if (size > FASTBIN_MAX || size < TCACHE_MIN) {
+        return 0;
+    }
+
+    int bin = (size - MIN_PAYLOAD) / 8;
+    tcnode_t *block = (tcnode_t *)header;
+    if (block->owner == &tcache) {
+        // Either a double free or user data that happens to match; the bin decides
+        for (fastnode_t *current = tcache.bins[bin]; current; current = current->next) {
+            if (current == &block->node) {
+                fprintf(stderr, "Error: Double-free detected at block %p\n", (void *)(header + 1));
+                exit(1);
+            }
+        }
+    }
+
+    if (tcache.count[bin] >= TCACHE_DEPTH) {
+        arena_t *held = NULL;
+        for (int i = 0; i < TCACHE_BATCH; i++) {
+            fastnode_t *victim = tcache.bins[bin];
+            tcache.bins[bin] = victim->next;
+            tcache.count[bin]--;
+            held = tcacheRelease(held, &victim->header);
+        }
+        ARENA_UNLOCK(held);
+    }
+
+    tcacheAdd(header);
+    return 1;
+}
+#endif
+
+int umeminit(size_t sizeOfRegion, int allocationAlgo) {
+    return umeminit_arenas(sizeOfRegion, allocationAlgo, 1);
+}
+
+int umeminit_arenas(size_t sizeOfRegion, int allocationAlgo, int arenaCount) {
+    return umeminit_flags(sizeOfRegion, allocationAlgo, arenaCount, 0);
+}
+
+int umeminit_flags(size_t sizeOfRegion, int allocationAlgo, int arenaCount, int flags) {
+    if (defaultHeap != NULL || sizeOfRegion <= 0) {
+        return -1;  // Return failure if already initialized
+    }
+    defaultHeap = umem_heap_create_flags(sizeOfRegion, allocationAlgo, arenaCount, flags);
+    return defaultHeap != NULL ? 0 : -1;
+}
+
+// Round bytes up to whole pages of the size the heap maps
+static size_t roundPages(int huge, size_t bytes) {
+    size_t pageSize = huge ? HUGE_PAGE_SIZE : (size_t)getpagesize();
+    return ((bytes + pageSize - 1) / pageSize) * pageSize;
+}
+
+// Map bytes (already rounded by roundPages) for a heap's region or chunk.
+// *backing is lowered to the backing this mapping got.
+static void *mapPages(size_t bytes, int huge, int *backing) {
+    if (!huge) {
+        return mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+
+#ifdef MAP_HUGETLB
+    int hugeFlags = MAP_HUGETLB;
+#ifdef MAP_HUGE_2MB
+    hugeFlags |= MAP_HUGE_2MB;  // Not the system default, which may be 1 GB
+#endif
+    void *pages = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | hugeFlags, -1, 0);
+    if (pages != MAP_FAILED) {
+        return pages;  // Already UMEM_PAGES_HUGETLB or weaker
+    }
+#endif
+
+    // No reserved huge pages: over-map, trim to a huge page boundary and ask for THP
+    char *raw = mmap(NULL, bytes + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+    char *aligned = (char *)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+    if (aligned > raw) {
+        munmap(raw, aligned - raw);
+    }
+    munmap(aligned + bytes, raw + HUGE_PAGE_SIZE - aligned);
+
+    int got = UMEM_PAGES_NORMAL;
+#ifdef MADV_HUGEPAGE
+    if (madvise(aligned, bytes, MADV_HUGEPAGE) == 0) {
+        got = UMEM_PAGES_THP;
+    }
+#endif
+    int current = __atomic_load_n(backing, __ATOMIC_RELAXED);  // Arenas may grow side by side
+    while (got < current && !__atomic_compare_exchange_n(backing, &current, got, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    return aligned;
+}
+
+// Hand bytes of fresh memory at start to arena a as one free block. A
+// header for the block and one for the fence that stops coalescing at the
+// end come out of it.
+static void spanSetup(arena_t *a, char *start, size_t bytes) {
+    node_t *block = (node_t *)start;
+    block->size = bytes - 2 * sizeof(header_t);
+    setFooter(block);
+
+    header_t *fence = nextBlock(block);
+    fence->size = BLOCK_ALLOC | PREV_FREE;  // Never freed, so nothing merges past it
+    setMagic(fence, (long)a->index << ARENA_SHIFT);
+
+    freeInsert(a, block);
+}
+
+// Lay out an empty arena for the active policy
+static int arenaSetup(arena_t *a) {
+    if (a->algo == BUDDY) {
+        return buddy_init(a);  // Fails if too small to hold the bitmaps and one block
+    }
+    if (a->size < 2 * sizeof(header_t) + MIN_PAYLOAD) {
+        return -1;
+    }
+
+    spanSetup(a, a->base, a->size);
+    return 0;
+}
+
+// Count bytes against the heap's cap; 0 if they would exceed it
+static int heapReserve(umem_heap_t *heap, size_t bytes) {
+    size_t mapped = __atomic_add_fetch(&heap->mapped, bytes, __ATOMIC_RELAXED);
+    if (heap->limit != 0 && mapped > heap->limit) {
+        __atomic_sub_fetch(&heap->mapped, bytes, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return 1;
+}
+
+// Map a chunk big enough for a size byte payload and give it to arena a.
+// Called with the arena lock held.
+static int arenaGrow(umem_heap_t *heap, arena_t *a, size_t size) {
+    size_t needed = roundPages(heap->hugePages, sizeof(chunk_t) + 2 * sizeof(header_t) + size);
+
+    // The next step of the geometric series, or just what the request needs
+    // if the cap leaves no room for that
+    size_t chunkSize = roundPages(heap->hugePages, a->growSize > needed ? a->growSize : needed);
+    if (chunkSize > MAX_PAYLOAD) {
+        chunkSize = needed;  // The series has outgrown what a header can describe
+    }
+    if (!heapReserve(heap, chunkSize)) {
+        chunkSize = needed;
+        if (!heapReserve(heap, chunkSize)) {
+            return -1;
+        }
+    }
+
+    chunk_t *chunk = mapPages(chunkSize, heap->hugePages, &heap->pageBacking);
+    if (chunk == MAP_FAILED) {
+        __atomic_sub_fetch(&heap->mapped, chunkSize, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    chunk->size = chunkSize;
+    chunk->arenaNext = a->chunks;
+    a->chunks = chunk;
+    a->growSize = chunkSize * 2;
+    spanSetup(a, (char *)(chunk + 1), chunkSize - sizeof(chunk_t));
+
+    // Publish it for heapContains; other arenas may be growing at the same time
+    chunk->next = __atomic_load_n(&heap->chunks, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&heap->chunks, &chunk->next, chunk, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    return 0;
+}
+
+// Give a request its own mapping, linked into the heap's list
+static header_t *largeAlloc(umem_heap_t *heap, size_t size) {
+    size_t pageSize = getpagesize();
+    if (size > SIZE_MAX - sizeof(mapped_t) - pageSize) {
+        return NULL;  // Rounding up would wrap
+    }
+    size_t bytes = ((sizeof(mapped_t) + size + pageSize - 1) / pageSize) * pageSize;
+    if (!heapReserve(heap, bytes)) {
+        return NULL;
+    }
+
+    mapped_t *block = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (block == MAP_FAILED) {
+        __atomic_sub_fetch(&heap->mapped, bytes, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    block->heap = heap;
+    block->size = bytes;
+    block->header.size = (bytes - sizeof(mapped_t)) | BLOCK_ALLOC;  // The whole mapping is usable
+    setMagic(&block->header, BLOCK_MAPPED);
+
+    LARGE_LOCK(heap);
+    block->prev = NULL;
+    block->next = heap->largeBlocks;
+    if (block->next) {
+        block->next->prev = block;
+    }
+    heap->largeBlocks = block;
+    LARGE_UNLOCK(heap);
+    return &block->header;
+}
+
+static void largeFree(umem_heap_t *heap, header_t *header) {
+    mapped_t *block = mappedOf(header);
+
+    LARGE_LOCK(heap);
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        heap->largeBlocks = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+    LARGE_UNLOCK(heap);
+
+    __atomic_sub_fetch(&heap->mapped, block->size, __ATOMIC_RELAXED);
+    munmap(block, block->size);
+}
+
+// Resize a mapped block with mremap, which moves pages instead of copying
+// them. NULL if the block has to be copied instead.
+static header_t *largeResize(umem_heap_t *heap, header_t *header, size_t size) {
+#ifdef MREMAP_MAYMOVE
+    mapped_t *block = mappedOf(header);
+    size_t pageSize = getpagesize();
+    if (size > SIZE_MAX - sizeof(mapped_t) - pageSize) {
+        return NULL;  // Rounding up would wrap
+    }
+    size_t bytes = ((sizeof(mapped_t) + size + pageSize - 1) / pageSize) * pageSize;
+    size_t oldBytes = block->size;
+    if (bytes > oldBytes && !heapReserve(heap, bytes - oldBytes)) {
+        return NULL;
+    }
+
+    // The neighbours point at the old address until the block is relinked
+    LARGE_LOCK(heap);
+    mapped_t *moved = mremap(block, oldBytes, bytes, MREMAP_MAYMOVE);
+    if (moved == MAP_FAILED) {
+        LARGE_UNLOCK(heap);
+        if (bytes > oldBytes) {
+            __atomic_sub_fetch(&heap->mapped, bytes - oldBytes, __ATOMIC_RELAXED);
+        }
+        return NULL;
+    }
+    if (moved->prev) {
+        moved->prev->next = moved;
+    } else {
+        heap->largeBlocks = moved;
+    }
+    if (moved->next) {
+        moved->next->prev = moved;
+    }
+    moved->size = bytes;
+    moved->header.size = (bytes - sizeof(mapped_t)) | BLOCK_ALLOC;
+    setMagic(&moved->header, BLOCK_MAPPED);
+    LARGE_UNLOCK(heap);
+
+    if (bytes < oldBytes) {
+        __atomic_sub_fetch(&heap->mapped, oldBytes - bytes, __ATOMIC_RELAXED);
+    }
+    return &moved->header;
+#else
+    (void)heap;
+    (void)header;
+    (void)size;
+    return NULL;  // No mremap on this platform
+#endif
+}
+
+int umemmapthreshold(size_t threshold) {
+    return umem_heap_set_mmap_threshold(defaultHeap, threshold);
+}
+
+int umem_heap_set_mmap_threshold(umem_heap_t *heap, size_t threshold) {
+    if (heap == NULL || (heap->file != NULL && threshold != 0)) {
+        return -1;  // A file heap's blocks all have to be in the file
+    }
+    heap->mmapThreshold = threshold;
+    return 0;
+}
+
+int umemgrow(size_t maxSize) {
+    return umem_heap_grow(defaultHeap, maxSize);
+}
+
+int umem_heap_grow(umem_heap_t *heap, size_t maxSize) {
+    if (heap == NULL || heap->algo == BUDDY || heap->file != NULL) {
+        return -1;  // Buddy bitmaps cover one contiguous area, and chunks would not be in the file
+    }
+    if (maxSize != 0 && maxSize < heap->mapped) {
+        return -1;  // Already larger than the cap
+    }
+
+    heap->limit = maxSize;
+    heap->growable = 1;
+    return 0;
+}
+
+int umemdecay(size_t threshold, unsigned decayMs) {
+    return umem_heap_set_decay(defaultHeap, threshold, decayMs);
+}
+
+int umem_heap_set_decay(umem_heap_t *heap, size_t threshold, unsigned decayMs) {
+    if (heap == NULL) {
+        return -1;
+    }
+
+    for (int i = 0; i < heap->arenaCount; i++) {
+        arena_t *a = &heap->arenas[i];
+        ARENA_LOCK(a);
+        a->releaseThreshold = threshold;
+        a->releaseDecay = decayMs;
+        a->dirtySince = 0;
+        ARENA_UNLOCK(a);
+    }
+    return 0;
+}
+
+void umempurge(void) {
+    umem_heap_purge(defaultHeap);
+}
+
+void umem_heap_purge(umem_heap_t *heap) {
+    if (heap == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < heap->arenaCount; i++) {
+        arena_t *a = &heap->arenas[i];
+        ARENA_LOCK(a);
+        arenaPurge(a, 0);
+        ARENA_UNLOCK(a);
+    }
+}
+
+umem_heap_t *umem_heap_create(size_t sizeOfRegion, int allocationAlgo, int arenaCount) {
+    return umem_heap_create_flags(sizeOfRegion, allocationAlgo, arenaCount, 0);
+}
+
+// Carve a zeroed heap struct's region at base into arenas and lay each out
+// for the policy. The caller has set the mapping fields beforehand.
+static int heapLayout(umem_heap_t *heap, char *base, size_t sizeOfRegion, int allocationAlgo, int arenaCount) {
+    heap->base = base;
+    heap->size = sizeOfRegion;
+    heap->algo = allocationAlgo;
+    heap->mapped = sizeOfRegion;
+    heap->arenaCount = arenaCount;
+#ifdef UMEM_THREADSAFE
+    pthread_mutex_init(&heap->largeLock, NULL);
+#endif
+
+    size_t arenaSize = (sizeOfRegion / arenaCount) & ~(size_t)(ARENA_ALIGN - 1);
+    if (arenaCount == 1) {
+        arenaSize = sizeOfRegion;
+    }
+    for (int i = 0; i < arenaCount; i++) {
+        arena_t *a = &heap->arenas[i];
+        a->base = heap->base + i * arenaSize;
+        a->size = arenaSize;
+        a->index = i;
+        a->algo = allocationAlgo;
+        a->growSize = arenaSize;
+        a->releaseThreshold = RELEASE_THRESHOLD;
+        a->releaseDecay = RELEASE_DECAY_MS;
+        a->pageSize = heap->hugePages ? HUGE_PAGE_SIZE : (size_t)getpagesize();  // Releasing less would split a huge page
+#ifdef UMEM_THREADSAFE
+        pthread_mutex_init(&a->lock, NULL);
+#endif
+        if (arenaSetup(a) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+umem_heap_t *umem_heap_create_flags(size_t sizeOfRegion, int allocationAlgo, int arenaCount, int flags) {
+    if (sizeOfRegion <= 0 || sizeOfRegion > MAX_PAYLOAD || arenaCount < 1 || arenaCount > MAX_ARENAS) {
+        return NULL;
+    }
+
+    // Round to whole pages, huge ones if asked for
+    int huge = (flags & UMEM_HUGE_PAGES) != 0;
+    sizeOfRegion = roundPages(huge, sizeOfRegion);
+
+    // Request memory using mmap; the heap struct gets its own zeroed mapping
+    size_t mapSize = sizeof(umem_heap_t) + arenaCount * sizeof(arena_t);
+    umem_heap_t *heap = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (heap == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    heap->pageBacking = huge ? UMEM_PAGES_HUGETLB : UMEM_PAGES_NORMAL;
+    char *base = mapPages(sizeOfRegion, huge, &heap->pageBacking);
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        munmap(heap, mapSize);
+        return NULL;
+    }
+
+    heap->mapSize = mapSize;
+    heap->mmapThreshold = MMAP_THRESHOLD;
+    heap->hugePages = huge;
+    if (heapLayout(heap, base, sizeOfRegion, allocationAlgo, arenaCount) != 0) {
+        munmap(base, sizeOfRegion);
+        munmap(heap, mapSize);
+        return NULL;  // Arena too small for the policy
+    }
+    return heap;
+}
+
+int umem_heap_destroy(umem_heap_t *heap) {
+    if (heap == NULL || heap == defaultHeap) {
+        return -1;  // The default heap lives as long as the process
+    }
+
+#ifdef UMEM_THREADSAFE
+    for (int i = 0; i < heap->arenaCount; i++) {
+        pthread_mutex_destroy(&heap->arenas[i].lock);
+    }
+    pthread_mutex_destroy(&heap->largeLock);
+#endif
+    if (heap->file != NULL) {
+        // The heap itself lives in the file, which keeps it for the next open
+        persist_t *file = heap->file;
+        int fd = heap->fd;
+        fileDetach(heap);
+        munmap(file->address, file->fileSize);
+        close(fd);
+        return 0;
+    }
+    mapped_t *block = heap->largeBlocks;
+    while (block) {
+        mapped_t *next = block->next;
+        munmap(block, block->size);
+        block = next;
+    }
+    chunk_t *chunk = heap->chunks;
+    while (chunk) {
+        chunk_t *next = chunk->next;
+        munmap(chunk, chunk->size);
+        chunk = next;
+    }
+    munmap(heap->base, heap->size);
+    munmap(heap, heap->mapSize);
+    return 0;
+}
+
+void *umalloc(size_t size) {
+    void *ptr = umalloc_from(defaultHeap, size);
+    if (tracing()) {
+        traceRecord(UMEM_TRACE_MALLOC, size, ptr, NULL);
+    }
+    return ptr;
+}
+
+void *umalloc_from(umem_heap_t *heap, size_t size) {
+    if (heap == NULL) {
+        return NULL;  // Ensure umeminit() is called first
+    }
+    if (size > MAX_PAYLOAD) {
+        return NULL;  // More than a header can describe
+    }
+
+    // Align requested size to 8 bytes; every block must be able to hold its footer later
+    size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (size < MIN_PAYLOAD) {
+        size = MIN_PAYLOAD;
+    }
+
+    header_t *header;
+    if (heap->mmapThreshold != 0 && size >= heap->mmapThreshold) {
+        header = largeAlloc(heap, size);
+        if (header == NULL) {
+            return NULL;
+        }
+        STAT_ADD(heap->allocated_memory, blockSize(header) + sizeof(header_t));
+        STAT_ADD(heap->total_allocations, 1);
+        return (void *)((char *)header + sizeof(header_t));
+    }
+
+    arena_t *home = pickArena(heap);
+    if (heap->algo == BUDDY) {
+        size = buddy_payload(home, size);  // So the fastbin lookup sees the size buddy hands out
+        if (size == 0) {
+            return NULL;  // Bigger than any buddy block
+        }
+    }
+
+    header = threadCached(heap) ? tcachePop(size) : NULL;
+    if (header == NULL) {
+        header = arenasAlloc(heap, home, size, 0, 1);
+    }
+    if (header == NULL) {
+        return NULL;  // Not enough contiguous space
+    }
+
+    STAT_ADD(heap->allocated_memory, blockSize(header) + sizeof(header_t));  // Include the entire block size (header + size request)
+    STAT_ADD(heap->total_allocations, 1);
+    return (void *)((char *)header + sizeof(header_t));  // Return pointer after header
+}
+
+void *ualigned_alloc(size_t alignment, size_t size) {
+    void *ptr = ualigned_alloc_from(defaultHeap, alignment, size);
+    if (tracing()) {
+        traceRecord(UMEM_TRACE_MALLOC, size, ptr, NULL);  // The alignment is not kept
+    }
+    return ptr;
+}
+
+int uposix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment == 0 || alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;  // Must be a power of two and a multiple of sizeof(void *)
+    }
+    void *ptr = ualigned_alloc(alignment, size);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+void *ualigned_alloc_from(umem_heap_t *heap, size_t alignment, size_t size) {
+    if (heap == NULL || alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        return NULL;  // Alignment must be a power of two
+    }
+    // The over-allocation below adds up to this much on top of size
+    size_t overhead = alignment + sizeof(node_t) + sizeof(header_t) + MIN_PAYLOAD + ALIGNMENT;
+    if (alignment > MAX_PAYLOAD || overhead > MAX_PAYLOAD || size > MAX_PAYLOAD - overhead) {
+        return NULL;  // More than a header can describe
+    }
+    if (alignment <= (size_t)ALIGNMENT) {
+        return umalloc_from(heap, size);  // Every block is aligned this well
+    }
+
+    size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (size < MIN_PAYLOAD) {
+        size = MIN_PAYLOAD;
+    }
+
+    // Buddy blocks and mapped blocks cannot move their header, so they are
+    // over-allocated and carry a stand-in header just below the aligned
+    // address that leads ufree back to the real one. It sits past the free
+    // links, which end sizeof(node_t) past the real header, so a second free
+    // of the same pointer is still caught.
+    if (heap->algo == BUDDY || (heap->mmapThreshold != 0 && size + alignment >= heap->mmapThreshold)) {
+        char *raw = umalloc_from(heap, size + alignment + sizeof(node_t));
+        if (raw == NULL) {
+            return NULL;
+        }
+        uintptr_t aligned = ((uintptr_t)raw + sizeof(node_t) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        header_t *stand = (header_t *)aligned - 1;
+        stand->size = (aligned - (uintptr_t)raw) | BLOCK_ALLOC;
+        setMagic(stand, BLOCK_OFFSET);
+        return (void *)aligned;
+    }
+
+    header_t *header = arenasAlloc(heap, pickArena(heap), size, alignment, 0);
+    if (header == NULL) {
+        return NULL;  // Not enough contiguous space
+    }
+
+    STAT_ADD(heap->allocated_memory, blockSize(header) + sizeof(header_t));
+    STAT_ADD(heap->total_allocations, 1);
+    return (void *)((char *)header + sizeof(header_t));
+}
+
+// Take a block from an arena, aligned if alignment is not 0
+static header_t *arenaTake(arena_t *a, size_t size, size_t alignment) {
+    return alignment ? alignedBlock(a, size, alignment) : heapAlloc(a, size);
+}
+
+// Take a block from the thread's own arena, then from the others in turn,
+// and finally from a new chunk if the heap may grow. With refill set, a hit
+// also stocks the thread cache with more blocks of size.
+static header_t *arenasAlloc(umem_heap_t *heap, arena_t *home, size_t size, size_t alignment, int refill) {
+    header_t *header = NULL;
+
+    for (int i = 0; header == NULL && i < heap->arenaCount; i++) {
+        arena_t *a = &heap->arenas[(home->index + i) % heap->arenaCount];
+        ARENA_LOCK(a);
+        header = arenaTake(a, size, alignment);
+        if (header != NULL && refill && threadCached(heap)) {
+            tcacheRefill(a, size);
+        }
+        ARENA_UNLOCK(a);
+    }
+
+    // Every arena is full: map more memory for this thread's arena if allowed
+    if (header == NULL && heap->growable) {
+        ARENA_LOCK(home);
+        header = arenaTake(home, size, alignment);  // Another thread may have grown it meanwhile
+        if (header == NULL && arenaGrow(heap, home, size + alignment + sizeof(header_t) + MIN_PAYLOAD) == 0) {
+            header = arenaTake(home, size, alignment);
+        }
+        ARENA_UNLOCK(home);
+    }
+    return header;
+}
+
+// Take a block whose payload is aligned to alignment. The block is taken
+// large enough that the slack in front of the aligned address can hold a free
+// block of its own; that slack goes straight back to the free structures and
+// the unused tail is trimmed off the same way.
+header_t *alignedBlock(arena_t *a, size_t size, size_t alignment) {
+    header_t *header = heapAlloc(a, size + alignment + sizeof(header_t) + MIN_PAYLOAD);
+    if (header == NULL) {
+        return NULL;
+    }
+
+    uintptr_t payload = (uintptr_t)(header + 1);
+    uintptr_t aligned = (payload + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (aligned != payload) {
+        while (aligned - payload < sizeof(header_t) + MIN_PAYLOAD) {
+            aligned += alignment;
+        }
+
+        size_t lead = aligned - payload;
+        size_t total = blockSize(header);
+        header_t *moved = (header_t *)aligned - 1;
+        blockAllocated(a, moved, total - lead);
+        header->size = (lead - sizeof(header_t)) | (LOAD_SIZE(header) & PREV_FREE);
+        addToFreeList(a, (node_t *)header);  // Marks moved's PREV_FREE
+        header = moved;
+    }
+
+    resizeBlock(a, header, size);
+    return header;
+}
+
+// Take a block from an arena: fastbins first, then the policy
+header_t *heapAlloc(arena_t *a, size_t size) {
+    arenaTick(a);
+    header_t *header = fastbinPop(a, size);
+    if (header == NULL) {
+        header = allocBlock(a, size);
+        if (header == NULL && a->fastCached > 0) {
+            fastbinFlush(a);  // Cached blocks may merge into something big enough
+            header = allocBlock(a, size);
+        }
+    }
+    return header;
+}
+
+// Take a block of at least size bytes from the active policy
+header_t *allocBlock(arena_t *a, size_t size) {
+    node_t *allocated_block = NULL;
+
+    switch (a->algo) { // Choose the algorithm to be run for the allocated size
+        case BEST_FIT:
+            allocated_block = best_fit(a, size);
+            break;
+        case WORST_FIT:
+            allocated_block = worst_fit(a, size);
+            break;
+        case FIRST_FIT:
+            allocated_block = first_fit(a, size);
+            break;
+        case NEXT_FIT:
+            allocated_block = next_fit(a, size);
+            break;
+        case TLSF:
+            allocated_block = tlsf_fit(a, size);
+            break;
+        case BUDDY:
+            return buddy_alloc(a, size + sizeof(header_t));  // Buddy blocks never live on freeList
+        default:
+            fprintf(stderr, "Error: Invalid allocation algorithm.\n");
+            return NULL;
+    }
+    /* Test case to see if there is a recognized algorith
+    if (allocated_block != NULL) {
+    printf("Selected block at address: %p, with size: %zu for requested size: %zu\n", allocated_block, blockSize(allocated_block), size);
+    }
+    */
+    if (allocated_block == NULL) {
+        return NULL;  // Not enough contiguous space
+    }
+
+    // Split the free block and mark the front as allocated
+    splitBlock(a, allocated_block, size);
+    return (header_t *)allocated_block;
+}
+
+int ufree(void *ptr) {
+    if (tracing()) {
+        traceRecord(UMEM_TRACE_FREE, 0, ptr, NULL);  // Before the address can be handed out again
+    }
+    return ufree_to(defaultHeap, ptr);
+}
+
+// An aligned pointer into a buddy or mapped block sits behind a stand-in
+// header; step back to the payload the block really starts at
+static inline void *realPayload(void *ptr) {
+    header_t *header = (header_t *)((char *)ptr - sizeof(header_t));
+    if ((magicWord(header) & (MAGIC_MASK | BLOCK_OFFSET)) == (MAGIC_TAG | BLOCK_OFFSET) && !isFree(header)) {
+        return (char *)ptr - blockSize(header);
+    }
+    return ptr;
+}
+
+int ufree_to(umem_heap_t *heap, void *ptr) {
+    if (ptr == NULL) return 1;
+    if (heap == NULL) return 0;
+
+    ptr = realPayload(ptr);
+    header_t *header = (header_t *)((char *)ptr - sizeof(header_t));
+
+    // Freeing clears BLOCK_ALLOC, and a free block's magic slot holds its list
+    // link, so the state bits have to be checked before the magic number
+    if (isFree(header) || (LOAD_SIZE(header) & BLOCK_FAST)) {
+        fprintf(stderr, "Error: Double-free detected at block %p\n", ptr);
+        exit(1);
+    }
+
+    if (!validMagic(heap, header)) { // Validation of the magic number (and that it is this heap's)
+        fprintf(stderr, "Error: Memory corruption detected at block %p\n", ptr);
+        exit(1);
+    }
+
+    STAT_ADD(heap->allocated_memory, -(blockSize(header) + sizeof(header_t)));  // Account for entire block size
+    STAT_ADD(heap->total_deallocations, 1);
+
+    if (magicWord(header) & BLOCK_MAPPED) {
+        largeFree(heap, header);
+    } else if (!threadCached(heap) || !tcachePush(header)) {
+        arena_t *a = arenaOf(heap, header);  // Whichever arena handed it out
+        ARENA_LOCK(a);
+        heapFree(a, header);
+        ARENA_UNLOCK(a);
+    }
+    return 1;
+}
+
+size_t umalloc_usable_size(void *ptr) {
+    if (ptr == NULL) {
+        return 0;
+    }
+    void *real = realPayload(ptr);
+    return blockSize((header_t *)real - 1) - ((char *)ptr - (char *)real);
+}
+
+// Give a block back to its arena: its fastbin if there is room, else the policy
+void heapFree(arena_t *a, header_t *header) {
+    arenaTick(a);
+    if (!fastbinPush(a, header)) {
+        releaseBlock(a, header);
+    }
+}
+
+// Hand a block back to the active policy
+void releaseBlock(arena_t *a, header_t *header) {
+    if (a->algo == BUDDY) {
+        buddy_free(a, header, (char *)header + sizeof(header_t));
+    } else {
+        addToFreeList(a, (node_t *)header);  // Merges with free neighbours as it goes
+    }
+}
+
+// Empty every fastbin into the policy so the blocks can merge again
+void fastbinFlush(arena_t *a) {
+    for (int bin = 0; bin < FASTBIN_COUNT; bin++) {
+        while (a->fastBins[bin]) {
+            header_t *header = fastbinPop(a, MIN_PAYLOAD + bin * 8);
+            releaseBlock(a, header);
+        }
+    }
+}
+
+void *urealloc(void *ptr, size_t size) {
+    if (!tracing()) {
+        return urealloc_from(defaultHeap, ptr, size);
+    }
+
+    // The old address is freed inside, so no other call may be logged in between
+    traceLock();
+    void *moved = urealloc_from(defaultHeap, ptr, size);
+    traceWrite(UMEM_TRACE_REALLOC, size, moved, ptr);
+    traceUnlock();
+    return moved;
+}
+
+void *urealloc_from(umem_heap_t *heap, void *ptr, size_t size) {
+    if (ptr == NULL) return umalloc_from(heap, size);
+    if (heap == NULL) return NULL;
+    if (size == 0) {
+        ufree_to(heap, ptr);
+        return NULL;
+    }
+    if (size > MAX_PAYLOAD) {
+        return NULL;  // More than a header can describe; ptr stays valid
+    }
+
+    size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (size < MIN_PAYLOAD) {
+        size = MIN_PAYLOAD;
+    }
+
+    void *real = realPayload(ptr);
+    if (real != ptr) {
+        // The aligned address cannot be kept when the block is resized, so it moves
+        size_t oldSize = blockSize((header_t *)real - 1) - ((char *)ptr - (char *)real);
+        void *moved = umalloc_from(heap, size);
+        if (moved != NULL) {
+            memcpy(moved, ptr, oldSize < size ? oldSize : size);
+            ufree_to(heap, real);
+        }
+        return moved;
+    }
+
+    header_t *header = (header_t *)((char *)ptr - sizeof(header_t));
+    if (!validMagic(heap, header) || isFree(header) || (LOAD_SIZE(header) & BLOCK_FAST)) {
+        fprintf(stderr, "Error: Memory corruption detected at block %p\n", ptr);
+        exit(1);
+    }
+
+    size_t oldSize = blockSize(header);
+    if (oldSize >= size && oldSize - size < sizeof(header_t) + MIN_PAYLOAD) {
+        return ptr;  // Fits, and the slack is too small to give back
+    }
+
+    if (magicWord(header) & BLOCK_MAPPED) {
+        // Remap while it stays large; below the threshold it moves into an arena
+        if (heap->mmapThreshold != 0 && size >= heap->mmapThreshold) {
+            header_t *moved = largeResize(heap, header, size);
+            if (moved != NULL) {
+                STAT_ADD(heap->allocated_memory, blockSize(moved) - oldSize);
+                return (void *)((char *)moved + sizeof(header_t));
+            }
+        }
+    } else {
+        // Grow into a free neighbour or give the tail back without moving the data
+        arena_t *a = arenaOf(heap, header);
+        ARENA_LOCK(a);
+        int resized = resizeBlock(a, header, size);
+        size_t newSize = blockSize(header);
+        ARENA_UNLOCK(a);
+        if (resized) {
+            STAT_ADD(heap->allocated_memory, newSize - oldSize);
+            return ptr;
+        }
+    }
+
+    void *new_block = umalloc_from(heap, size);
+    if (new_block == NULL) return NULL;
+
+    memcpy(new_block, ptr, oldSize < size ? oldSize : size);
+    ufree_to(heap, ptr);
+    return new_block;
+}
+
+void umemstats(void) {
+    umemstats_from(defaultHeap);
+}
+
+void umemstats_from(umem_heap_t *heap) {
+    if (heap == NULL) {
+        return;
+    }
+
+    size_t free_memory = STAT_GET(heap->mapped) - STAT_GET(heap->allocated_memory);  // Correctly calculate free memory
+    size_t fragmentation = calculateFragmentation(heap);
+
+    printumemstats((int)STAT_GET(heap->total_allocations), 
+                   (int)STAT_GET(heap->total_deallocations), 
+                   (long)STAT_GET(heap->allocated_memory), 
+                   (long)free_memory, 
+                   (double)fragmentation);
+
+    size_t released = 0;
+    for (int i = 0; i < heap->arenaCount; i++) {
+        ARENA_LOCK(&heap->arenas[i]);
+        released += heap->arenas[i].releasedBytes;
+        ARENA_UNLOCK(&heap->arenas[i]);
+    }
+    printf("Released Memory: %zu bytes\n", released);
+    if (heap->hugePages) {
+        static const char *backings[] = {"none (base pages)", "transparent (MADV_HUGEPAGE)", "MAP_HUGETLB"};
+        printf("Huge Pages: %s\n", backings[__atomic_load_n(&heap->pageBacking, __ATOMIC_RELAXED)]);
+    }
+#ifdef UMEM_THREADSAFE
+    size_t acquisitions = 0, contentions = 0;
+    for (int i = 0; i < heap->arenaCount; i++) {
+        arena_t *a = &heap->arenas[i];
+        ARENA_LOCK(a);
+        acquisitions += a->lockAcquisitions;
+        ARENA_UNLOCK(a);
+        contentions += STAT_GET(a->lockContentions);
+    }
+    printf("Arenas: %d\n", heap->arenaCount);
+    printf("Lock Acquisitions: %zu\n", acquisitions);
+    printf("Lock Contentions: %zu\n", contentions);
+#endif
+}
+
+void umemsnapshot(umem_stats_t *stats) {
+    umemsnapshot_from(defaultHeap, stats);
+}
+
+// Everything here is a counter kept up to date as blocks move, so the cost
+// does not depend on how many blocks the heap holds
+void umemsnapshot_from(umem_heap_t *heap, umem_stats_t *stats) {
+    if (stats == NULL) {
+        return;
+    }
+    memset(stats, 0, sizeof(*stats));
+    if (heap == NULL) {
+        return;
+    }
+
+    stats->allocations = STAT_GET(heap->total_allocations);
+    stats->deallocations = STAT_GET(heap->total_deallocations);
+    stats->allocated = STAT_GET(heap->allocated_memory);
+    stats->mapped = STAT_GET(heap->mapped);
+    stats->pageBacking = __atomic_load_n(&heap->pageBacking, __ATOMIC_RELAXED);
+
+    for (int i = 0; i < heap->arenaCount; i++) {
+        arena_t *a = &heap->arenas[i];
+        ARENA_LOCK(a);
+        stats->released += a->releasedBytes;
+        stats->freeBytes += a->freeBytes;
+        stats->freeBlocks += a->freeBlocks;
+        for (int k = 0; k < UMEM_SIZE_CLASSES; k++) {
+            stats->freeClasses[k] += a->freeClasses[k];
+        }
+        size_t largest = arenaLargest(a);
+        if (largest > stats->largestFree) {
+            stats->largestFree = largest;
+        }
+        ARENA_UNLOCK(a);
+    }
+}
+
+void umemstats_json(FILE *out) {
+    umemstats_json_from(defaultHeap, out);
+}
+
+void umemstats_json_from(umem_heap_t *heap, FILE *out) {
+    umem_stats_t stats;
+    umemsnapshot_from(heap, &stats);
+
+    fprintf(out, "{\"allocations\":%zu,\"deallocations\":%zu,\"allocated\":%zu,\"mapped\":%zu,"
+                 "\"released\":%zu,\"free_bytes\":%zu,\"free_blocks\":%zu,\"largest_free\":%zu,"
+                 "\"page_backing\":\"%s\",\"free_classes\":[",
+            stats.allocations, stats.deallocations, stats.allocated, stats.mapped,
+            stats.released, stats.freeBytes, stats.freeBlocks, stats.largestFree,
+            stats.pageBacking == UMEM_PAGES_HUGETLB ? "hugetlb" : stats.pageBacking == UMEM_PAGES_THP ? "thp" : "normal");
+    for (int k = 0; k < UMEM_SIZE_CLASSES; k++) {
+        fprintf(out, k ? ",%zu" : "%zu", stats.freeClasses[k]);
+    }
+    fprintf(out, "]}\n");
+}
+
+static inline int keyLess(tnode_t *a, tnode_t *b) {
+    return blockSize(a) < blockSize(b) || (blockSize(a) == blockSize(b) && a < b);
+}
+
+// Smallest free block of at least size bytes, lowest address among equals
+static tnode_t *treeLowerBound(arena_t *a, size_t size) {
+    tnode_t *found = NULL;
+    tnode_t *current = a->sizeTree;
+
+    while (current) {
+        if (blockSize(current) >= size) {
+            found = current;
+            current = current->left;
+        } else {
+            current = current->right;
+        }
+    }
+
+    return found;
+}
+
+node_t *best_fit(arena_t *a, size_t size) {
+    return (node_t *)treeLowerBound(a, size);
+}
+
+node_t *worst_fit(arena_t *a, size_t size) {
+    tnode_t *largest = a->sizeTree;
+
+    while (largest && largest->right) {
+        largest = largest->right;
+    }
+    if (!largest || blockSize(largest) < size) {
+        return NULL;
+    }
+
+    // Like the list scan, prefer the lowest address among the largest blocks
+    return (node_t *)treeLowerBound(a, blockSize(largest));
+}
+
+node_t *first_fit(arena_t *a, size_t size) {
+    node_t *current = a->freeList;
+
+    while (current) {
+        if (blockSize(current) >= size) {
+            return current;
+        }
+        current = current->next;
+    }
+
+    return NULL;
+}
+
+// lastAlloc is the free block the previous search stopped at (or what replaced it)
+node_t *next_fit(arena_t *a, size_t size) {
+    node_t *start = (a->lastAlloc) ? a->lastAlloc : a->freeList;
+    node_t *current = start;
+
+    while (current) {
+        if (blockSize(current) >= size) {
+            a->lastAlloc = current;
+            return current;
+        }
+        current = current->next;
+    }
+
+    current = a->freeList;
+    while (current && current != start) {
+        if (blockSize(current) >= size) {
+            a->lastAlloc = current;
+            return current;
+        }
+        current = current->next;
+    }
+
+    return NULL;
+}
+
+// TLSF mapping from a size to its (first level, second level) list
+static inline void tlsfMapping(size_t size, int *fl, int *sl) {
+    if (size < TLSF_SMALL_SIZE) {
+        *fl = 0;
+        *sl = (int)(size / (TLSF_SMALL_SIZE / TLSF_SL_COUNT));
+    } else {
+        int log2 = 63 - __builtin_clzl(size);
+        *sl = (int)(size >> (log2 - TLSF_SL_LOG2)) ^ TLSF_SL_COUNT;
+        *fl = log2 - (TLSF_FL_SHIFT - 1);
+    }
+}
+
+// Every block in the first non-empty list at or above the rounded-up size
+// is big enough, so taking the head of that list needs no scan.
+node_t *tlsf_fit(arena_t *a, size_t size) {
+    int fl, sl;
+
+    if (size >= TLSF_SMALL_SIZE) {
+        size += ((size_t)1 << (63 - __builtin_clzl(size) - TLSF_SL_LOG2)) - 1;
+    }
+    tlsfMapping(size, &fl, &sl);
+    if (fl >= TLSF_FL_COUNT) {
+        return NULL;
+    }
+
+    uint32_t slMap = a->tlsfSlMap[fl] & (~0U << sl);
+    if (slMap == 0) {
+        uint64_t flMap = (fl + 1 < TLSF_FL_COUNT) ? a->tlsfFlMap & (~0UL << (fl + 1)) : 0;
+        if (flMap == 0) {
+            return NULL;  // Not enough contiguous space
+        }
+        fl = __builtin_ctzl(flMap);
+        slMap = a->tlsfSlMap[fl];
+    }
+    sl = __builtin_ctz(slMap);
+
+    return a->tlsfLists[fl][sl];
+}
+
+void blockAllocated(arena_t *a, void *block, size_t size) {
+    header_t *header = (header_t *)block;
+    header->size = size | BLOCK_ALLOC;
+    setMagic(header, (long)a->index << ARENA_SHIFT);
+}
+
+// Free list primitives. The list stays sorted by address so FIRST_FIT and
+// NEXT_FIT keep their placement, but unlinking and replacing are O(1).
+static void listRemove(arena_t *a, node_t *block) {
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        a->freeList = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+    if (a->lastAlloc == block) {
+        a->lastAlloc = block->next;
+    }
+}
+
+static void listReplace(arena_t *a, node_t *old, node_t *block) {
+    block->next = old->next;
+    block->prev = old->prev;
+    if (block->prev) {
+        block->prev->next = block;
+    } else {
+        a->freeList = block;
+    }
+    if (block->next) {
+        block->next->prev = block;
+    }
+    if (a->lastAlloc == old) {
+        a->lastAlloc = block;
+    }
+}
+
+static void listInsert(arena_t *a, node_t *block) {
+    node_t *current = a->freeList;
+    node_t *prev = NULL;
+
+    // Insert the block back into the free list sorted by address
+    while (current && current < block) {
+        prev = current;
+        current = current->next;
+    }
+
+    block->next = current;
+    block->prev = prev;
+    if (prev) {
+        prev->next = block;
+    } else {
+        a->freeList = block;
+    }
+    if (current) {
+        current->prev = block;
+    }
+}
+
+// Size index primitives (BEST_FIT, WORST_FIT)
+static inline unsigned long treePriority(tnode_t *node) {
+    return ((uintptr_t)node >> 4) * 0x9E3779B97F4A7C15UL;
+}
+
+static tnode_t *treeInsertAt(tnode_t *root, tnode_t *node) {
+    if (root == NULL) {
+        node->left = node->right = NULL;
+        return node;
+    }
+
+    if (keyLess(node, root)) {
+        root->left = treeInsertAt(root->left, node);
+        if (treePriority(root->left) > treePriority(root)) {
+            tnode_t *pivot = root->left;  // Rotate right
+            root->left = pivot->right;
+            pivot->right = root;
+            root = pivot;
+        }
+    } else {
+        root->right = treeInsertAt(root->right, node);
+        if (treePriority(root->right) > treePriority(root)) {
+            tnode_t *pivot = root->right;  // Rotate left
+            root->right = pivot->left;
+            pivot->left = root;
+            root = pivot;
+        }
+    }
+
+    return root;
+}
+
+// Join two subtrees where every key in left is smaller than every key in right
+static tnode_t *treeJoin(tnode_t *left, tnode_t *right) {
+    if (left == NULL) return right;
+    if (right == NULL) return left;
+
+    if (treePriority(left) > treePriority(right)) {
+        left->right = treeJoin(left->right, right);
+        return left;
+    }
+    right->left = treeJoin(left, right->left);
+    return right;
+}
+
+static tnode_t *treeRemoveAt(tnode_t *root, tnode_t *node) {
+    if (root == node) {
+        return treeJoin(root->left, root->right);
+    }
+    if (keyLess(node, root)) {
+        root->left = treeRemoveAt(root->left, node);
+    } else {
+        root->right = treeRemoveAt(root->right, node);
+    }
+    return root;
+}
+
+static void treeInsert(arena_t *a, node_t *block) {
+    a->sizeTree = treeInsertAt(a->sizeTree, (tnode_t *)block);
+}
+
+static void treeRemove(arena_t *a, node_t *block) {
+    a->sizeTree = treeRemoveAt(a->sizeTree, (tnode_t *)block);
+}
+
+// Segregated list primitives (TLSF)
+static void tlsfInsert(arena_t *a, node_t *block) {
+    int fl, sl;
+    tlsfMapping(blockSize(block), &fl, &sl);
+
+    block->prev = NULL;
+    block->next = a->tlsfLists[fl][sl];
+    if (block->next) {
+        block->next->prev = block;
+    }
+    a->tlsfLists[fl][sl] = block;
+    a->tlsfSlMap[fl] |= 1U << sl;
+    a->tlsfFlMap |= 1UL << fl;
+}
+
+static void tlsfRemove(arena_t *a, node_t *block) {
+    int fl, sl;
+    tlsfMapping(blockSize(block), &fl, &sl);
+
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        a->tlsfLists[fl][sl] = block->next;
+        if (block->next == NULL) {
+            a->tlsfSlMap[fl] &= ~(1U << sl);
+            if (a->tlsfSlMap[fl] == 0) {
+                a->tlsfFlMap &= ~(1UL << fl);
+            }
+        }
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+}
+
+// Free block accounting. Every block that enters or leaves the free
+// structures passes through the primitives below, which keep these counters
+// current so a stats snapshot never walks the heap.
+static inline int sizeClass(size_t size) {
+    int k = 63 - __builtin_clzl(size | 1) - 4;  // Class 0 is 16 to 31 bytes
+    if (k < 0) {
+        return 0;
+    }
+    return k < UMEM_SIZE_CLASSES ? k : UMEM_SIZE_CLASSES - 1;
+}
+
+// The address ordered list has no size index, so FIRST_FIT and NEXT_FIT also
+// count their free blocks in the size ranges of the TLSF lists. When the
+// biggest block is taken, the top non-empty range gives the next one: exactly
+// if it holds a single block, otherwise as the average of its blocks, which
+// is within one sixteenth of it.
+static inline void listClass(size_t size, int *fl, int *sl) {
+    tlsfMapping(size, fl, sl);
+    if (*fl >= TLSF_FL_COUNT) {
+        *fl = TLSF_FL_COUNT - 1;
+        *sl = TLSF_SL_COUNT - 1;
+    }
+}
+
+static inline void freeAdded(arena_t *a, size_t size) {
+    a->freeBytes += size;
+    a->freeBlocks++;
+    a->freeClasses[sizeClass(size)]++;
+    if (a->algo == FIRST_FIT || a->algo == NEXT_FIT) {
+        int fl, sl;
+        listClass(size, &fl, &sl);
+        a->listCount[fl][sl]++;
+        a->listBytes[fl][sl] += size;
+        if (size >= a->largestFree) {
+            a->largestFree = size;
+            a->largestStale = 0;
+        }
+    }
+}
+
+static inline void freeDropped(arena_t *a, size_t size) {
+    a->freeBytes -= size;
+    a->freeBlocks--;
+    a->freeClasses[sizeClass(size)]--;
+    if (a->algo == FIRST_FIT || a->algo == NEXT_FIT) {
+        int fl, sl;
+        listClass(size, &fl, &sl);
+        a->listCount[fl][sl]--;
+        a->listBytes[fl][sl] -= size;
+        if (size >= a->largestFree) {
+            a->largestStale = 1;
+        }
+    }
+}
+
+// Free structure dispatch: the size index for BEST_FIT and WORST_FIT, the
+// segregated lists for TLSF and the address ordered list for everything else.
+static inline int addressOrdered(arena_t *a) {
+    return a->algo == FIRST_FIT || a->algo == NEXT_FIT;
+}
+
+void freeInsert(arena_t *a, node_t *block) {
+    freeAdded(a, blockSize(block));
+    if (blockSize(block) < LINK_PAYLOAD) {
+        return;  // Counted as free, but too small to index
+    }
+    switch (a->algo) {
+        case BEST_FIT:
+        case WORST_FIT:
+            treeInsert(a, block);
+            break;
+        case TLSF:
+            tlsfInsert(a, block);
+            break;
+        default:
+            listInsert(a, block);
+    }
+}
+
+static void freeRemove(arena_t *a, node_t *block) {
+    freeDropped(a, blockSize(block));
+    if (blockSize(block) < LINK_PAYLOAD) {
+        return;
+    }
+    switch (a->algo) {
+        case BEST_FIT:
+        case WORST_FIT:
+            treeRemove(a, block);
+            break;
+        case TLSF:
+            tlsfRemove(a, block);
+            break;
+        default:
+            listRemove(a, block);
+    }
+}
+
+// Put block where old was. Callers guarantee no free block lies between the
+// two, which keeps the list sorted; the size-keyed structures need the new
+// key instead.
+static void freeReplace(arena_t *a, node_t *old, node_t *block) {
+    if (addressOrdered(a) && blockSize(old) >= LINK_PAYLOAD && blockSize(block) >= LINK_PAYLOAD) {
+        freeDropped(a, blockSize(old));
+        freeAdded(a, blockSize(block));
+        listReplace(a, old, block);
+    } else {
+        freeRemove(a, old);
+        freeInsert(a, block);
+    }
+}
+
+// Change the size of a block that stays free and indexed
+static void freeResize(arena_t *a, node_t *block, size_t size) {
+    if (addressOrdered(a) && blockSize(block) >= LINK_PAYLOAD && size >= LINK_PAYLOAD) {
+        freeDropped(a, blockSize(block));
+        freeAdded(a, size);
+        block->size = size;
+    } else {
+        freeRemove(a, block);
+        block->size = size;
+        freeInsert(a, block);
+    }
+}
+
+// Carve an allocation of size bytes off the front of a free block. The tail
+// stays free and takes the block's place; a tail too small to hold a free
+// block is handed out with the allocation instead.
+void splitBlock(arena_t *a, node_t *block, size_t size) {
+    size_t available = blockSize(block);
+
+    if (available >= size + sizeof(header_t) + MIN_PAYLOAD) {
+        node_t *remainder = (node_t *)((char *)block + sizeof(header_t) + size);
+        long clean = block->size & BLOCK_CLEAN;  // Still released past its header
+        if ((char *)remainder < (char *)block + sizeof(node_t)) {
+            // Only with the compact header: the remainder's header lands on block's links
+            freeRemove(a, block);
+            remainder->size = (available - size - sizeof(header_t)) | clean;
+            setFooter(remainder);
+            freeInsert(a, remainder);
+        } else {
+            remainder->size = (available - size - sizeof(header_t)) | clean;
+            setFooter(remainder);
+            freeReplace(a, block, remainder);
+        }
+    } else {
+        size = available;
+        freeRemove(a, block);
+        CLEAR_BITS(nextBlock(block), PREV_FREE);
+    }
+
+    blockAllocated(a, block, size);
+}
+
+// Return a block to the free structures, merging it with whichever physical
+// neighbours are free. The boundary tags make each merge O(1); only a block
+// with no free neighbour has to search the list for its position.
+void addToFreeList(arena_t *a, node_t *block) {
+    header_t *next = nextBlock(block);
+    int prevFree = (block->size & PREV_FREE) != 0;
+    int nextFree = isFree(next);
+    long clean = 0;  // Whether the merged block's pages are all released
+
+    block->size = blockSize(block);
+
+    if (nextFree) {
+        // Nothing lies between the block and next, so it can take next's slot in the list
+        long nextClean = LOAD_SIZE(next) & BLOCK_CLEAN;
+        block->size += sizeof(header_t) + blockSize(next);
+        if (prevFree) {
+            freeRemove(a, (node_t *)next);
+        } else {
+            freeReplace(a, (node_t *)next, block);
+        }
+        // Only once next is off the list: the release may zero its links
+        clean = mergeClean(a, (char *)block, (char *)next, (char *)nextBlock(block), 0, nextClean);
+    }
+
+    if (prevFree) {
+        // The footer just before our header holds the size of the free block in front of us
+        long prevSize = *(long *)((char *)block - sizeof(long));
+        node_t *prev = (node_t *)((char *)block - sizeof(header_t) - prevSize);
+        long prevClean = prev->size & BLOCK_CLEAN;
+        char *end = (char *)nextBlock(block);
+        freeResize(a, prev, blockSize(prev) + sizeof(header_t) + block->size);
+        clean = mergeClean(a, (char *)prev, (char *)block, end, prevClean, clean);
+        block = prev;
+    } else if (!nextFree) {
+        freeInsert(a, block);
+    }
+
+    setFooter(block);
+    block->size |= clean;
+    SET_BITS(nextBlock(block), PREV_FREE);
+    arenaDecay(a, block);
+}
+
+// Resize an allocated block where it stands: grow it into the free block that
+// follows, then split off whatever it no longer needs. Returns 0, with the
+// block untouched, if it cannot grow far enough and has to move.
+int resizeBlock(arena_t *a, header_t *header, size_t size) {
+    if (a->algo == BUDDY) {
+        if (size > MAX_PAYLOAD) {
+            return 0;  // Adding the header would wrap
+        }
+        return buddy_resize(a, header, size + sizeof(header_t));
+    }
+
+    size_t available = blockSize(header);
+    if (available < size) {
+        header_t *next = nextBlock(header);
+        if (!isFree(next) || available + sizeof(header_t) + blockSize(next) < size) {
+            return 0;
+        }
+        available += sizeof(header_t) + blockSize(next);
+        freeRemove(a, (node_t *)next);
+        CLEAR_BITS(nextBlock(next), PREV_FREE);
+        header->size = available | (LOAD_SIZE(header) & ~SIZE_MASK);
+    }
+
+    // The tail becomes a block of its own and is freed like any other
+    if (available >= size + sizeof(header_t) + MIN_PAYLOAD) {
+        header->size = size | (LOAD_SIZE(header) & ~SIZE_MASK);
+        header_t *tail = nextBlock(header);
+        blockAllocated(a, tail, available - size - sizeof(header_t));
+        addToFreeList(a, (node_t *)tail);
+    }
+    return 1;
+}
+
+// Bytes in an arena's free blocks smaller than below; also raises *largest
+// to the arena's biggest free block
+static size_t arenaFreeBytes(arena_t *a, size_t below, size_t *largest) {
+    size_t bytes = 0;
+
+    if (a->algo == BUDDY) {
+        for (int order = 0; order <= a->buddyMaxOrder; order++) {
+            for (node_t *current = a->buddyLists[order]; current; current = current->next) {
+                if (blockSize(current) > *largest) {
+                    *largest = blockSize(current);
+                }
+                if (blockSize(current) < below) {
+                    bytes += blockSize(current);
+                }
+            }
+        }
+        return bytes;
+    }
+
+    // Walk the arena and its chunks block by block so every policy's free
+    // structure is covered; the fence at the end of each is the only block of size 0
+    chunk_t *chunk = a->chunks;
+    header_t *current = (header_t *)a->base;
+    while (current) {
+        for (; blockSize(current) != 0; current = nextBlock(current)) {
+            if (isFree(current)) {
+                if (blockSize(current) > *largest) {
+                    *largest = blockSize(current);
+                }
+                if (blockSize(current) < below) {
+                    bytes += blockSize(current);
+                }
+            }
+        }
+        current = chunk ? (header_t *)(chunk + 1) : NULL;
+        chunk = chunk ? chunk->arenaNext : NULL;
+    }
+    return bytes;
+}
+
+// Size of an arena's biggest free block, read off its free structures. Only
+// the address ordered list has no size index; it keeps a running maximum and
+// falls back on its size ranges once that block has been taken.
+static size_t arenaLargest(arena_t *a) {
+    switch (a->algo) {
+        case BEST_FIT:
+        case WORST_FIT: {
+            tnode_t *current = a->sizeTree;
+            while (current && current->right) {
+                current = current->right;
+            }
+            return current ? blockSize(current) : 0;
+        }
+        case TLSF: {
+            if (a->tlsfFlMap == 0) {
+                return 0;
+            }
+            int fl = 63 - __builtin_clzl(a->tlsfFlMap);
+            int sl = 31 - __builtin_clz(a->tlsfSlMap[fl]);
+            size_t largest = 0;
+            for (node_t *current = a->tlsfLists[fl][sl]; current; current = current->next) {
+                if (blockSize(current) > largest) {
+                    largest = blockSize(current);
+                }
+            }
+            return largest;
+        }
+        case BUDDY:
+            for (int order = a->buddyMaxOrder; order >= 0; order--) {
+                if (a->buddyLists[order]) {
+                    return blockSize(a->buddyLists[order]);
+                }
+            }
+            return 0;
+        default:
+            if (a->largestStale) {
+                a->largestFree = 0;
+                for (int i = TLSF_FL_COUNT * TLSF_SL_COUNT - 1; i >= 0; i--) {
+                    size_t count = a->listCount[i / TLSF_SL_COUNT][i % TLSF_SL_COUNT];
+                    if (count) {
+                        a->largestFree = a->listBytes[i / TLSF_SL_COUNT][i % TLSF_SL_COUNT] / count;
+                        break;
+                    }
+                }
+                a->largestStale = 0;
+            }
+            return a->largestFree;
+    }
+}
+
+size_t calculateFragmentation(umem_heap_t *heap) {
+    size_t totalFree = 0;
+    size_t fragmentedFree = 0;
+    size_t largestFreeBlock = 0;
+
+    for (int i = 0; i < heap->arenaCount; i++) {
+        arena_t *a = &heap->arenas[i];
+        ARENA_LOCK(a);
+        totalFree += arenaFreeBytes(a, SIZE_MAX, &largestFreeBlock);
+        ARENA_UNLOCK(a);
+    }
+
+    // Define small blocks as those less than half of the largest free block (as in the prompt)
+    for (int i = 0; i < heap->arenaCount; i++) {
+        arena_t *a = &heap->arenas[i];
+        ARENA_LOCK(a);
+        fragmentedFree += arenaFreeBytes(a, largestFreeBlock / 2, &largestFreeBlock);
+        ARENA_UNLOCK(a);
+    }
+
+    // Calculate fragmentation percentage
+    return (totalFree == 0) ? 0 : (fragmentedFree * 100) / totalFree; // this is a ternary operator, found on stack overflow
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// BUDDY helpers
+//
+// Blocks are 2^(BUDDY_MIN_SHIFT + order) bytes and aligned to their own size
+// relative to buddyBase, so a block's buddy is found by flipping one bit of
+// its offset. Allocation and free touch at most one list entry per order.
+
+static inline size_t buddyBlockSize(int order) {
+    return (size_t)1 << (BUDDY_MIN_SHIFT + order);
+}
+
+static inline size_t buddyBit(arena_t *a, int order, size_t offset) {
+    return a->buddyMapStart[order] + (offset >> (BUDDY_MIN_SHIFT + order));
+}
+
+static inline int buddyIsFree(arena_t *a, int order, size_t offset) {
+    size_t bit = buddyBit(a, order, offset);
+    return (a->buddyMap[bit / 64] >> (bit % 64)) & 1;
+}
+
+static void buddyPush(arena_t *a, node_t *block, int order) {
+    size_t bit = buddyBit(a, order, (char *)block - a->buddyBase);
+
+    block->size = buddyBlockSize(order) - sizeof(header_t);
+    freeAdded(a, blockSize(block));
+    block->prev = NULL;
+    block->next = a->buddyLists[order];
+    if (a->buddyLists[order]) {
+        a->buddyLists[order]->prev = block;
+    }
+    a->buddyLists[order] = block;
+    a->buddyMap[bit / 64] |= (uint64_t)1 << (bit % 64);
+}
+
+static void buddyRemove(arena_t *a, node_t *block, int order) {
+    size_t bit = buddyBit(a, order, (char *)block - a->buddyBase);
+
+    freeDropped(a, blockSize(block));
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        a->buddyLists[order] = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+    a->buddyMap[bit / 64] &= ~((uint64_t)1 << (bit % 64));
+}
+
+int buddy_init(arena_t *a) {
+    // Size the bitmaps for the whole arena; it over-counts slightly since
+    // the bitmaps themselves are carved from the front of the arena.
+    size_t bits = 0;
+    for (int order = 0; order <= BUDDY_MAX_ORDER; order++) {
+        a->buddyMapStart[order] = bits;
+        bits += a->size >> (BUDDY_MIN_SHIFT + order);
+    }
+
+    size_t mapBytes = ((bits + 63) / 64) * sizeof(uint64_t);
+    mapBytes = (mapBytes + buddyBlockSize(0) - 1) & ~(buddyBlockSize(0) - 1);
+    if (mapBytes + buddyBlockSize(0) > a->size) {
+        return -1;
+    }
+
+    a->buddyMap = (uint64_t *)a->base;  // mmap hands back zeroed pages, so every bit starts clear
+    a->buddyBase = a->base + mapBytes;
+    a->buddySize = a->size - mapBytes;
+
+    a->buddyMaxOrder = 0;
+    while (a->buddyMaxOrder < BUDDY_MAX_ORDER && buddyBlockSize(a->buddyMaxOrder + 1) <= a->buddySize) {
+        a->buddyMaxOrder++;
+    }
+
+    // Cover the area with the largest aligned blocks that fit, biggest first
+    size_t offset = 0;
+    for (int order = a->buddyMaxOrder; order >= 0; order--) {
+        while (offset + buddyBlockSize(order) <= a->buddySize) {
+            buddyPush(a, (node_t *)(a->buddyBase + offset), order);
+            offset += buddyBlockSize(order);
+        }
+    }
+
+    return 0;
+}
+
+// Payload of the block buddy_alloc hands out for a request of size bytes,
+// 0 if even the largest order is too small
+size_t buddy_payload(arena_t *a, size_t size) {
+    int order = 0;
+    while (order < a->buddyMaxOrder && buddyBlockSize(order) < size + sizeof(header_t)) {
+        order++;
+    }
+    if (buddyBlockSize(order) < size + sizeof(header_t)) {
+        return 0;
+    }
+    return buddyBlockSize(order) - sizeof(header_t);
+}
+
+header_t *buddy_alloc(arena_t *a, size_t size) {
+    int order = 0;
+    while (order <= a->buddyMaxOrder && buddyBlockSize(order) < size) {
+        order++;
+    }
+
+    // Smallest non-empty order that can hold the request
+    int current = order;
+    while (current <= a->buddyMaxOrder && a->buddyLists[current] == NULL) {
+        current++;
+    }
+    if (current > a->buddyMaxOrder) {
+        return NULL;  // Not enough contiguous space
+    }
+
+    node_t *block = a->buddyLists[current];
+    long clean = block->size & BLOCK_CLEAN;
+    buddyRemove(a, block, current);
+
+    // Split down to the requested order, returning each upper half to its list
+    while (current > order) {
+        current--;
+        node_t *half = (node_t *)((char *)block + buddyBlockSize(current));
+        buddyPush(a, half, current);
+        half->size |= clean;
+    }
+
+    blockAllocated(a, block, buddyBlockSize(order) - sizeof(header_t));
+    return (header_t *)block;
+}
+
+int buddy_free(arena_t *a, header_t *header, void *ptr) {
+    size_t offset = (char *)header - a->buddyBase;
+    size_t bytes = blockSize(header) + sizeof(header_t);
+    int order = 0;
+
+    while (order <= a->buddyMaxOrder && buddyBlockSize(order) < bytes) {
+        order++;
+    }
+    if ((char *)header < a->buddyBase || offset >= a->buddySize || order > a->buddyMaxOrder ||
+        buddyBlockSize(order) != bytes || (offset & (bytes - 1)) != 0) {
+        fprintf(stderr, "Error: Memory corruption detected at block %p\n", ptr);
+        exit(1);
+    }
+
+
+    // Merge with the buddy for as long as it is free at the same order
+    long clean = 0;
+    while (order < a->buddyMaxOrder) {
+        size_t buddyOffset = offset ^ buddyBlockSize(order);
+        if (buddyOffset + buddyBlockSize(order) > a->buddySize || !buddyIsFree(a, order, buddyOffset)) {
+            break;
+        }
+        node_t *buddy = (node_t *)(a->buddyBase + buddyOffset);
+        long buddyClean = buddy->size & BLOCK_CLEAN;
+        size_t low = offset < buddyOffset ? offset : buddyOffset;
+        buddyRemove(a, buddy, order);
+        clean = mergeClean(a, a->buddyBase + low, a->buddyBase + low + buddyBlockSize(order),
+                           a->buddyBase + low + 2 * buddyBlockSize(order),
+                           low == offset ? clean : buddyClean, low == offset ? buddyClean : clean);
+        offset &= ~buddyBlockSize(order);
+        order++;
+    }
+
+    buddyPush(a, (node_t *)(a->buddyBase + offset), order);
+    ((node_t *)(a->buddyBase + offset))->size |= clean;
+    arenaDecay(a, (node_t *)(a->buddyBase + offset));
+    return 1;
+}
+
+// Move an allocated block to the order that fits size bytes without moving
+// it: absorb free buddies above it to grow, hand back upper halves to shrink
+int buddy_resize(arena_t *a, header_t *header, size_t size) {
+    size_t offset = (char *)header - a->buddyBase;
+    int order = 0;
+    int target = 0;
+
+    while (order < a->buddyMaxOrder && buddyBlockSize(order) < blockSize(header) + sizeof(header_t)) {
+        order++;
+    }
+    while (target < a->buddyMaxOrder && buddyBlockSize(target) < size) {
+        target++;
+    }
+    if (buddyBlockSize(target) < size) {
+        return 0;  // Bigger than the arena
+    }
+
+    // Growing only works while the block is the lower half and its buddy is free
+    for (int k = order; k < target; k++) {
+        size_t buddyOffset = offset + buddyBlockSize(k);
+        if ((offset & (buddyBlockSize(k + 1) - 1)) != 0 ||
+            buddyOffset + buddyBlockSize(k) > a->buddySize || !buddyIsFree(a, k, buddyOffset)) {
+            return 0;
+        }
+    }
+    for (int k = order; k < target; k++) {
+        buddyRemove(a, (node_t *)(a->buddyBase + offset + buddyBlockSize(k)), k);
+    }
+
+    for (int k = order; k > target; k--) {
+        buddyPush(a, (node_t *)(a->buddyBase + offset + buddyBlockSize(k - 1)), k - 1);
+    }
+
+    header->size = (buddyBlockSize(target) - sizeof(header_t)) | (LOAD_SIZE(header) & ~SIZE_MASK);
+    return 1;
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Batch allocation
+//
+// umalloc_batch carves a whole batch out of one block: a single policy search
+// and split, then a header every size + 16 bytes. If no block is big enough
+// the batch is taken in halves, then quarters, and so on. ufree_batch sorts
+// the pointers by address so that blocks lying back to back reach the free
+// structures as one merged block, and takes an arena's lock once for each
+// run of its blocks rather than once per pointer.
+
+size_t umalloc_batch(size_t size, size_t count, void **out) {
+    size_t done = umalloc_batch_from(defaultHeap, size, count, out);
+    if (tracing()) {
+        traceLock();
+        for (size_t i = 0; i < done; i++) {
+            traceWrite(UMEM_TRACE_MALLOC, size, out[i], NULL);
+        }
+        traceUnlock();
+    }
+    return done;
+}
+
+size_t umalloc_batch_from(umem_heap_t *heap, size_t size, size_t count, void **out) {
+    if (heap == NULL || out == NULL || size > MAX_PAYLOAD - sizeof(header_t) - ALIGNMENT) {
+        return 0;  // The stride below would not fit in a header
+    }
+
+    size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (size < MIN_PAYLOAD) {
+        size = MIN_PAYLOAD;
+    }
+
+    size_t done = 0;
+
+    // Large blocks get a mapping each, and buddy blocks cannot be cut up
+    if (heap->algo == BUDDY || (heap->mmapThreshold != 0 && size >= heap->mmapThreshold)) {
+        while (done < count && (out[done] = umalloc_from(heap, size)) != NULL) {
+            done++;
+        }
+        return done;
+    }
+
+    size_t stride = size + sizeof(header_t);
+    size_t run = count < MAX_PAYLOAD / stride ? count : MAX_PAYLOAD / stride;  // So run * stride cannot wrap
+    arena_t *home = pickArena(heap);
+    while (done < count && run > 0) {
+        if (run > count - done) {
+            run = count - done;
+        }
+        header_t *header = arenasAlloc(heap, home, run * stride - sizeof(header_t), 0, 0);  // A span, not a size class
+        if (header == NULL) {
+            run /= 2;
+            continue;
+        }
+
+        // Only this thread can see past the first header; the last block keeps any tail
+        arena_t *a = arenaOf(heap, header);
+        size_t total = blockSize(header) + sizeof(header_t);
+        for (size_t i = 1; i < run; i++) {
+            header_t *piece = (header_t *)((char *)header + i * stride);
+            blockAllocated(a, piece, i + 1 < run ? size : total - i * stride - sizeof(header_t));
+        }
+        if (run > 1) {
+            ARENA_LOCK(a);  // Freeing the block in front sets PREV_FREE in the first header
+            header->size = size | (LOAD_SIZE(header) & ~SIZE_MASK);
+            ARENA_UNLOCK(a);
+        }
+        for (size_t i = 0; i < run; i++) {
+            out[done++] = (char *)header + i * stride + sizeof(header_t);
+        }
+
+        STAT_ADD(heap->allocated_memory, total);
+        STAT_ADD(heap->total_allocations, run);
+    }
+    return done;
+}
+
+int ufree_batch(void **ptrs, size_t count) {
+    if (tracing() && ptrs != NULL) {
+        traceLock();  // Before the addresses can be handed out again
+        for (size_t i = 0; i < count; i++) {
+            traceWrite(UMEM_TRACE_FREE, 0, ptrs[i], NULL);
+        }
+        traceUnlock();
+    }
+    return ufree_batch_to(defaultHeap, ptrs, count);
+}
+
+static int comparePointers(const void *x, const void *y) {
+    uintptr_t p = (uintptr_t)*(void *const *)x;
+    uintptr_t q = (uintptr_t)*(void *const *)y;
+    return (p > q) - (p < q);
+}
+
+int ufree_batch_to(umem_heap_t *heap, void **ptrs, size_t count) {
+    if (ptrs == NULL || count == 0) return 1;
+    if (heap == NULL) return 0;
+
+    // Drop the NULLs and sort the rest in place
+    size_t live = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (ptrs[i] != NULL) {
+            ptrs[live++] = realPayload(ptrs[i]);
+        }
+    }
+    qsort(ptrs, live, sizeof(void *), comparePointers);
+
+    // Check every block before freeing any; a pointer listed twice sorts next to itself
+    size_t bytes = 0;
+    for (size_t i = 0; i < live; i++) {
+        header_t *header = (header_t *)ptrs[i] - 1;
+        if (isFree(header) || (LOAD_SIZE(header) & BLOCK_FAST) || (i > 0 && ptrs[i] == ptrs[i - 1])) {
+            fprintf(stderr, "Error: Double-free detected at block %p\n", ptrs[i]);
+            exit(1);
+        }
+        if (!validMagic(heap, header)) {
+            fprintf(stderr, "Error: Memory corruption detected at block %p\n", ptrs[i]);
+            exit(1);
+        }
+        bytes += blockSize(header) + sizeof(header_t);
+    }
+    STAT_ADD(heap->allocated_memory, -bytes);
+    STAT_ADD(heap->total_deallocations, live);
+
+    arena_t *held = NULL;
+    for (size_t i = 0; i < live; i++) {
+        header_t *header = (header_t *)ptrs[i] - 1;
+        if (magicWord(header) & BLOCK_MAPPED) {
+            if (held != NULL) {
+                ARENA_UNLOCK(held);
+                held = NULL;
+            }
+            largeFree(heap, header);
+            continue;
+        }
+
+        arena_t *a = arenaOf(heap, header);
+        if (a != held) {
+            if (held != NULL) {
+                ARENA_UNLOCK(held);
+            }
+            ARENA_LOCK(a);
+            held = a;
+        }
+
+        // Fold in the blocks that follow it directly; buddies merge by their own rules
+        while (a->algo != BUDDY && i + 1 < live && (header_t *)ptrs[i + 1] - 1 == nextBlock(header)) {
+            header_t *next = (header_t *)ptrs[++i] - 1;
+            header->size = (blockSize(header) + sizeof(header_t) + blockSize(next)) | (LOAD_SIZE(header) & ~SIZE_MASK);
+            next->size = 0;  // Freeing it again is reported as a double free
+        }
+        heapFree(a, header);
+    }
+    if (held != NULL) {
+        ARENA_UNLOCK(held);
+    }
+    return 1;
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Page release
+//
+// A large free block hands the pages strictly inside it back to the OS with
+// madvise, keeping its links at the front and its footer at the back. Rather
+// than paying a syscall (and later a page fault) on every free, an arena
+// waits until it has held an unreleased large block for releaseDecay
+// milliseconds and then releases all of them at once. The deadline is checked
+// whenever a call reaches the arena, not only when another large block is
+// freed, but a heap nobody calls into keeps its pages until umem_heap_purge.
+// BLOCK_CLEAN marks blocks that have nothing left to release. Splitting keeps
+// the mark; merging keeps it too, releasing right away just the pages the
+// other part still held, so a released range is never handed to madvise (or
+// counted) twice.
+
+static unsigned long nowMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// First and last byte a free block spanning [block, end) can release: the
+// pages past its links and short of its footer
+static inline uintptr_t releaseStart(arena_t *a, char *block) {
+    return ((uintptr_t)block + sizeof(node_t) + a->pageSize - 1) & ~(a->pageSize - 1);
+}
+
+static inline uintptr_t releaseEnd(arena_t *a, char *end) {
+    return ((uintptr_t)end - sizeof(long)) & ~(a->pageSize - 1);
+}
+
+static void releaseRange(arena_t *a, uintptr_t start, uintptr_t end) {
+    if (end > start && madvise((void *)start, end - start, MADV_DONTNEED) == 0) {
+        a->releasedBytes += end - start;
+    }
+}
+
+static void releasePages(arena_t *a, node_t *block) {
+    releaseRange(a, releaseStart(a, (char *)block), releaseEnd(a, (char *)nextBlock(block)));
+    block->size |= BLOCK_CLEAN;
+}
+
+// Called with the arena lock held as the free blocks [first, second) and
+// [second, end) merge. If either was clean, release the pages of the merged
+// block that the other still held, so the result stays clean; returns the
+// BLOCK_CLEAN bit for it.
+static long mergeClean(arena_t *a, char *first, char *second, char *end, long firstClean, long secondClean) {
+    if (!firstClean && !secondClean) {
+        return 0;
+    }
+
+    // Whatever lies outside the clean parts' ranges, within the merged block's
+    uintptr_t start = releaseStart(a, first);
+    uintptr_t stop = releaseEnd(a, end);
+    uintptr_t from = firstClean ? releaseEnd(a, second) : start;
+    uintptr_t to = secondClean ? releaseStart(a, second) : stop;
+    releaseRange(a, from > start ? from : start, to < stop ? to : stop);
+    return BLOCK_CLEAN;
+}
+
+// Called with the arena lock held for every block that has just become free
+void arenaDecay(arena_t *a, node_t *block) {
+    if (a->releaseThreshold == 0 || blockSize(block) < a->releaseThreshold || (block->size & BLOCK_CLEAN)) {
+        return;
+    }
+    if (a->releaseDecay == 0) {
+        releasePages(a, block);
+        return;
+    }
+
+    if (a->dirtySince == 0) {
+        a->dirtySince = nowMs();
+    } else {
+        arenaTick(a);
+    }
+}
+
+// Called with the arena lock held on the way into the arena: release what it
+// holds once the oldest unreleased block has waited out the decay. Only reads
+// the clock while something is waiting.
+void arenaTick(arena_t *a) {
+    if (a->dirtySince != 0 && nowMs() - a->dirtySince >= a->releaseDecay) {
+        arenaPurge(a, a->releaseThreshold);
+    }
+}
+
+static void releaseList(arena_t *a, node_t *list, size_t minSize) {
+    for (node_t *current = list; current; current = current->next) {
+        if (blockSize(current) >= minSize && !(current->size & BLOCK_CLEAN)) {
+            releasePages(a, current);
+        }
+    }
+}
+
+// Smaller keys sit to the left, so a node below minSize rules out its left subtree
+static void releaseTree(arena_t *a, tnode_t *node, size_t minSize) {
+    for (; node; node = node->right) {
+        if (blockSize(node) >= minSize) {
+            if (!(node->size & BLOCK_CLEAN)) {
+                releasePages(a, (node_t *)node);
+            }
+            releaseTree(a, node->left, minSize);
+        }
+    }
+}
+
+// Release every free block of at least minSize bytes that still holds pages.
+// Only the free structures are walked, and only the part of them that can
+// hold blocks that big, so the cost follows the large free blocks rather
+// than the size of the arena.
+void arenaPurge(arena_t *a, size_t minSize) {
+    switch (a->algo) {
+        case BEST_FIT:
+        case WORST_FIT:
+            releaseTree(a, a->sizeTree, minSize);
+            break;
+        case TLSF: {
+            int fl, sl;
+            tlsfMapping(minSize, &fl, &sl);
+            for (; fl < TLSF_FL_COUNT; fl++, sl = 0) {
+                for (uint32_t slMap = a->tlsfSlMap[fl] & (~0U << sl); slMap; slMap &= slMap - 1) {
+                    releaseList(a, a->tlsfLists[fl][__builtin_ctz(slMap)], minSize);
+                }
+            }
+            break;
+        }
+        case BUDDY:
+            for (int order = 0; order <= a->buddyMaxOrder; order++) {
+                if (buddyBlockSize(order) >= minSize + sizeof(header_t)) {
+                    releaseList(a, a->buddyLists[order], minSize);
+                }
+            }
+            break;
+        default:
+            releaseList(a, a->freeList, minSize);
+    }
+    a->dirtySince = 0;
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Object pools
+//
+// A pool hands out objects of one size from slabs it takes from a heap with
+// umalloc_from. Objects carry no header: a slab is carved front to back as
+// objects are first needed, and a freed object goes on the pool's free list
+// with the link in its first word. Slabs go back to the heap only when the
+// pool is destroyed.
+
+#define POOL_SLAB_SIZE (64 * 1024)  // Bytes per slab while the heap can spare them
+
+typedef struct __slab_t {
+    struct __slab_t *next;        // Every slab of the pool
+    long pad;                     // Keeps the objects 16-byte aligned
+} slab_t;
+
+typedef struct __poolnode_t {
+    struct __poolnode_t *next;    // Next free object
+} poolnode_t;
+
+struct __upool_t {
+    umem_heap_t *heap;            // Where the slabs come from
+    size_t objectSize;            // Rounded up to ALIGNMENT
+    size_t slabSize;              // Bytes asked for per slab
+    slab_t *slabs;
+    poolnode_t *freeList;         // Objects freed back to the pool
+    char *bump;                   // Next never-used object in the newest slab
+    char *bumpEnd;                // End of the newest slab
+#ifdef UMEM_THREADSAFE
+    pthread_mutex_t lock;
+#endif
+};
+
+#ifdef UMEM_THREADSAFE
+#define POOL_LOCK(pool)     pthread_mutex_lock(&(pool)->lock)
+#define POOL_UNLOCK(pool)   pthread_mutex_unlock(&(pool)->lock)
+#else
+#define POOL_LOCK(pool)
+#define POOL_UNLOCK(pool)
+#endif
+
+upool_t *upool_create(size_t objectSize) {
+    return upool_create_from(defaultHeap, objectSize);
+}
+
+upool_t *upool_create_from(umem_heap_t *heap, size_t objectSize) {
+    if (heap == NULL || objectSize == 0) {
+        return NULL;
+    }
+    if (objectSize > (MAX_PAYLOAD - sizeof(slab_t)) / 8) {
+        return NULL;  // A slab of eight could not be allocated, and rounding could wrap
+    }
+
+    upool_t *pool = umalloc_from(heap, sizeof(upool_t));
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    objectSize = (objectSize + ALIGNMENT - 1) & ~(ALIGNMENT - 1);  // Also leaves room for the free link
+    memset(pool, 0, sizeof(upool_t));
+    pool->heap = heap;
+    pool->objectSize = objectSize;
+    pool->slabSize = POOL_SLAB_SIZE;
+    if (pool->slabSize < sizeof(slab_t) + 8 * objectSize) {
+        pool->slabSize = sizeof(slab_t) + 8 * objectSize;  // At least eight objects per slab
+    }
+#ifdef UMEM_THREADSAFE
+    pthread_mutex_init(&pool->lock, NULL);
+#endif
+    return pool;
+}
+
+// Take another slab from the heap, halving the request while the heap
+// cannot supply it, down to a single object
+static int poolGrow(upool_t *pool) {
+    size_t bytes = pool->slabSize;
+    slab_t *slab = umalloc_from(pool->heap, bytes);
+    while (slab == NULL && bytes / 2 >= sizeof(slab_t) + pool->objectSize) {
+        bytes /= 2;
+        slab = umalloc_from(pool->heap, bytes);
+    }
+    if (slab == NULL) {
+        return -1;
+    }
+
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->bump = (char *)(slab + 1);
+    pool->bumpEnd = (char *)slab + bytes;
+    return 0;
+}
+
+void *upool_alloc(upool_t *pool) {
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    void *object = NULL;
+    POOL_LOCK(pool);
+    if (pool->freeList != NULL) {
+        object = pool->freeList;
+        pool->freeList = pool->freeList->next;
+    } else if ((size_t)(pool->bumpEnd - pool->bump) >= pool->objectSize || poolGrow(pool) == 0) {
+        object = pool->bump;
+        pool->bump += pool->objectSize;
+    }
+    POOL_UNLOCK(pool);
+    return object;
+}
+
+void upool_free(upool_t *pool, void *ptr) {
+    if (pool == NULL || ptr == NULL) {
+        return;
+    }
+
+    poolnode_t *object = (poolnode_t *)ptr;
+    POOL_LOCK(pool);
+    object->next = pool->freeList;
+    pool->freeList = object;
+    POOL_UNLOCK(pool);
+}
+
+void upool_destroy(upool_t *pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    slab_t *slab = pool->slabs;
+    while (slab) {
+        slab_t *next = slab->next;
+        ufree_to(pool->heap, slab);
+        slab = next;
+    }
+#ifdef UMEM_THREADSAFE
+    pthread_mutex_destroy(&pool->lock);
+#endif
+    ufree_to(pool->heap, pool);
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Bump arenas
+//
+// A bump arena hands out memory by advancing a pointer through chunks it
+// takes from a heap with umalloc_from. Nothing is freed on its own: reset
+// gives back every chunk but one and rewinds, destroy gives back all of
+// them. Requests too big to fit comfortably in a chunk get a chunk of their
+// own, so they do not waste the rest of the current one.
+
+#define UARENA_CHUNK_SIZE (64 * 1024)  // Default bytes per chunk
+
+typedef struct __bumpchunk_t {
+    struct __bumpchunk_t *next;   // Every chunk of the arena, current one first
+    size_t size;                  // Bytes in the chunk, this struct included
+} bumpchunk_t;
+
+struct __uarena_t {
+    umem_heap_t *heap;            // Where the chunks come from
+    size_t chunkSize;             // Bytes asked for per regular chunk
+    bumpchunk_t *chunks;
+    char *bump;                   // Next free byte in the current chunk
+    char *end;                    // End of the current chunk
+};
+
+uarena_t *uarena_create(size_t chunkSize) {
+    return uarena_create_from(defaultHeap, chunkSize);
+}
+
+uarena_t *uarena_create_from(umem_heap_t *heap, size_t chunkSize) {
+    if (heap == NULL) {
+        return NULL;
+    }
+
+    uarena_t *arena = umalloc_from(heap, sizeof(uarena_t));
+    if (arena == NULL) {
+        return NULL;
+    }
+
+    arena->heap = heap;
+    arena->chunkSize = chunkSize ? chunkSize : UARENA_CHUNK_SIZE;
+    if (arena->chunkSize < 2 * sizeof(bumpchunk_t)) {
+        arena->chunkSize = 2 * sizeof(bumpchunk_t);
+    }
+    arena->chunks = NULL;
+    arena->bump = NULL;
+    arena->end = NULL;
+    return arena;
+}
+
+void *uarena_alloc(uarena_t *arena, size_t size) {
+    if (arena == NULL) {
+        return NULL;
+    }
+    if (size > MAX_PAYLOAD) {
+        return NULL;  // Rounding, or adding the chunk record, could wrap
+    }
+
+    size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (size == 0) {
+        size = ALIGNMENT;  // Distinct pointers even for empty requests
+    }
+    if ((size_t)(arena->end - arena->bump) >= size) {
+        void *ptr = arena->bump;
+        arena->bump += size;
+        return ptr;
+    }
+
+    // A request over a quarter of a chunk gets its own chunk behind the current one
+    int own = size > arena->chunkSize / 4;
+    size_t bytes = own ? sizeof(bumpchunk_t) + size : arena->chunkSize;
+    bumpchunk_t *chunk = umalloc_from(arena->heap, bytes);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    chunk->size = bytes;
+
+    if (own && arena->chunks != NULL) {
+        chunk->next = arena->chunks->next;
+        arena->chunks->next = chunk;
+        return chunk + 1;
+    }
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->bump = (char *)(chunk + 1) + size;
+    arena->end = (char *)chunk + bytes;
+    return chunk + 1;
+}
+
+// Free every chunk but keep, and rewind into, one of regular size
+void uarena_reset(uarena_t *arena) {
+    if (arena == NULL) {
+        return;
+    }
+
+    bumpchunk_t *kept = NULL;
+    bumpchunk_t *chunk = arena->chunks;
+    while (chunk) {
+        bumpchunk_t *next = chunk->next;
+        if (kept == NULL && chunk->size == arena->chunkSize) {
+            kept = chunk;
+        } else {
+            ufree_to(arena->heap, chunk);
+        }
+        chunk = next;
+    }
+
+    arena->chunks = kept;
+    if (kept != NULL) {
+        kept->next = NULL;
+        arena->bump = (char *)(kept + 1);
+        arena->end = (char *)kept + kept->size;
+    } else {
+        arena->bump = NULL;
+        arena->end = NULL;
+    }
+}
+
+void uarena_destroy(uarena_t *arena) {
+    if (arena == NULL) {
+        return;
+    }
+
+    bumpchunk_t *chunk = arena->chunks;
+    while (chunk) {
+        bumpchunk_t *next = chunk->next;
+        ufree_to(arena->heap, chunk);
+        chunk = next;
+    }
+    ufree_to(arena->heap, arena);
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Persistent heaps
+//
+// umem_heap_open keeps a heap in a file mapped MAP_SHARED: the file record,
+// the heap struct with its arenas and the region all live in the mapping, so
+// the next process to open the file finds every block and free structure
+// where the last one left them. Nothing is rebuilt on reattach; the file just
+// has to land at the address it was made at, which MAP_FIXED_NOREPLACE asks
+// for without clobbering anything already there. An flock keeps a second
+// process out while one has the file open.
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0     // Older headers: the address is only a hint, checked below
+#endif
+
+// New heap files go in gigabyte slots from UMEM_FILE_BASE to UMEM_FILE_BASE +
+// UMEM_FILE_SPAN, clear of the program, its libraries and stack, so the
+// address is likely free in later processes too. The file's inode picks the
+// first slot to try, so two files seldom want the same one; if the first few
+// are taken, the kernel chooses. Define either at build time to move them.
+#ifndef UMEM_FILE_BASE
+#define UMEM_FILE_BASE 0x200000000000UL  // 32 TB
+#endif
+#ifndef UMEM_FILE_SPAN
+#define UMEM_FILE_SPAN 0x200000000000UL
+#endif
+#define FILE_SLOT     (1UL << 30)        // Slots are whole gigabytes
+#define FILE_ATTEMPTS 16
+
+// Bytes before the region: the record and the heap struct, page aligned
+static size_t fileRegionOffset(int arenaCount) {
+    return roundPages(0, FILE_HEAP + sizeof(umem_heap_t) + arenaCount * sizeof(arena_t));
+}
+
+// Write the first page, where the record lives, through to the file
+static void fileSyncRecord(persist_t *file) {
+    msync(file, getpagesize(), MS_SYNC);
+}
+
+// Map a new heap file at a slot of the range above, else wherever it fits
+static persist_t *fileMap(int fd, size_t fileSize) {
+    struct stat info;
+    size_t span = (fileSize + FILE_SLOT - 1) & ~(FILE_SLOT - 1);
+    size_t slots = span <= UMEM_FILE_SPAN ? UMEM_FILE_SPAN / span : 0;
+
+    if (slots > 0 && fstat(fd, &info) == 0) {
+        size_t first = (size_t)(info.st_ino * 0x9E3779B97F4A7C15ULL >> 32) % slots;
+        for (size_t i = 0; i < FILE_ATTEMPTS && i < slots; i++) {
+            void *hint = (void *)(UMEM_FILE_BASE + (first + i) % slots * span);
+            void *file = mmap(hint, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+            if (file == hint) {
+                return file;
+            }
+            if (file != MAP_FAILED) {
+                munmap(file, fileSize);  // Only a hint to this kernel, and it went elsewhere
+            }
+        }
+    }
+    return mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+}
+
+// Lay out a new heap in the empty file behind fd; on failure the caller
+// empties the file again
+static umem_heap_t *fileCreate(int fd, const char *path, size_t sizeOfRegion, int allocationAlgo, int arenaCount) {
+    if (sizeOfRegion <= 0 || sizeOfRegion > MAX_PAYLOAD || arenaCount < 1 || arenaCount > MAX_ARENAS) {
+        return NULL;
+    }
+    sizeOfRegion = roundPages(0, sizeOfRegion);
+    size_t offset = fileRegionOffset(arenaCount);
+    size_t fileSize = offset + sizeOfRegion;
+
+    // Reserve the blocks now, so a full disk fails here and not as SIGBUS later
+    int error = ftruncate(fd, fileSize) != 0 ? errno : posix_fallocate(fd, 0, fileSize);
+    if (error != 0) {
+        fprintf(stderr, "Error: Could not size heap file %s: %s\n", path, strerror(error));
+        return NULL;
+    }
+    persist_t *file = fileMap(fd, fileSize);
+    if (file == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    umem_heap_t *heap = (umem_heap_t *)((char *)file + FILE_HEAP);
+    heap->mapSize = offset;
+    heap->pageBacking = UMEM_PAGES_NORMAL;
+    heap->file = file;
+    heap->fd = fd;
+    if (heapLayout(heap, (char *)file + offset, sizeOfRegion, allocationAlgo, arenaCount) != 0) {
+        munmap(file, fileSize);
+        return NULL;  // Arena too small for the policy
+    }
+    for (int i = 0; i < arenaCount; i++) {
+        heap->arenas[i].releaseThreshold = 0;  // Released pages of a shared file are only dropped from memory
+    }
+
+    file->layout = FILE_LAYOUT;
+    file->address = (char *)file;
+    file->fileSize = fileSize;
+    fileSyncRecord(file);
+    memcpy(file->tag, FILE_TAG, 8);  // Last, so a file cut short by a crash is never taken for a heap
+    fileSyncRecord(file);
+    return heap;
+}
+
+// Map the heap already in the file behind fd back where it was made
+static umem_heap_t *fileAttach(int fd, const char *path, size_t fileSize) {
+    persist_t record;
+    if (pread(fd, &record, sizeof(record), 0) != (ssize_t)sizeof(record) || memcmp(record.tag, FILE_TAG, 8) != 0) {
+        fprintf(stderr, "Error: %s is not a umem heap\n", path);
+        return NULL;
+    }
+    if (record.layout != FILE_LAYOUT || record.fileSize != fileSize) {
+        fprintf(stderr, "Error: Heap file %s was made by a different build or has been resized\n", path);
+        return NULL;
+    }
+    if (!record.clean) {
+        fprintf(stderr, "Error: Heap file %s was not closed cleanly\n", path);
+        return NULL;  // Its free structures may be half updated
+    }
+
+    persist_t *file = mmap(record.address, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    if (file != (persist_t *)record.address) {
+        if (file != MAP_FAILED) {
+            munmap(file, fileSize);
+        }
+        fprintf(stderr, "Error: Address %p of heap file %s is taken in this process\n", (void *)record.address, path);
+        return NULL;
+    }
+
+    // Only this process's state needs resetting: the descriptor, the locks and the clock
+    umem_heap_t *heap = (umem_heap_t *)((char *)file + FILE_HEAP);
+    heap->fd = fd;
+#ifdef UMEM_THREADSAFE
+    pthread_mutex_init(&heap->largeLock, NULL);
+#endif
+    for (int i = 0; i < heap->arenaCount; i++) {
+#ifdef UMEM_THREADSAFE
+        pthread_mutex_init(&heap->arenas[i].lock, NULL);
+#endif
+        heap->arenas[i].dirtySince = 0;
+    }
+
+    file->clean = 0;
+    fileSyncRecord(file);
+    return heap;
+}
+
+umem_heap_t *umem_heap_open(const char *path, size_t sizeOfRegion, int allocationAlgo, int arenaCount) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        fprintf(stderr, "Error: Heap file %s is in use by another process\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    struct stat info;
+    umem_heap_t *heap = NULL;
+    if (fstat(fd, &info) != 0) {
+        perror(path);
+    } else if (info.st_size == 0) {
+        heap = fileCreate(fd, path, sizeOfRegion, allocationAlgo, arenaCount);
+        if (heap == NULL && ftruncate(fd, 0) != 0) {
+            perror(path);  // Left without a tag, the next open refuses it
+        }
+    } else {
+        heap = fileAttach(fd, path, info.st_size);
+    }
+    if (heap == NULL) {
+        close(fd);  // Drops the lock too
+    }
+    return heap;
+}
+
+// Flush the heap to its file and mark it clean; the mapping stays
+static void fileDetach(umem_heap_t *heap) {
+    persist_t *file = heap->file;
+    msync(file, file->fileSize, MS_SYNC);
+    file->clean = 1;  // Only once everything it vouches for is on disk
+    fileSyncRecord(file);
+}
+
+static void fileDetachDefault(void) {
+    if (defaultHeap != NULL && defaultHeap->file != NULL) {
+        fileDetach(defaultHeap);
+    }
+}
+
+int umeminit_file(const char *path, size_t sizeOfRegion, int allocationAlgo, int arenaCount) {
+    if (defaultHeap != NULL) {
+        return -1;  // Return failure if already initialized
+    }
+    defaultHeap = umem_heap_open(path, sizeOfRegion, allocationAlgo, arenaCount);
+    if (defaultHeap == NULL) {
+        return -1;
+    }
+    atexit(fileDetachDefault);  // The default heap is never destroyed, so it is closed at exit
+    return 0;
+}
+
+void *umemroot(void) {
+    return umem_heap_root(defaultHeap);
+}
+
+int umemsetroot(void *ptr) {
+    return umem_heap_set_root(defaultHeap, ptr);
+}
+
+void *umem_heap_root(umem_heap_t *heap) {
+    return heap != NULL && heap->file != NULL ? heap->file->root : NULL;
+}
+
+int umem_heap_set_root(umem_heap_t *heap, void *ptr) {
+    if (heap == NULL || heap->file == NULL) {
+        return -1;  // Only a file heap outlives the process
+    }
+    heap->file->root = ptr;
+    return 0;
+}
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Tracing
+//
+// While a trace is open, umalloc, urealloc and ufree each append a record to
+// a buffer that is written out with write(2) when full; the aligned calls
+// append one too, and the batch calls one per block. The file is plain
+// records after an 8-byte tag, so replay.c can read it back with one fread.
+// Plain stdio is avoided since it allocates, which would recurse once umalloc
+// stands in for malloc.
+
+#define TRACE_BUFFER 2048        // Records held before a write
+#define TRACE_TAG    "UMTRACE1"
+
+static int traceFd = -1;
+static unsigned long traceStart;  // Nanoseconds on the monotonic clock
+static umem_trace_record_t traceBuffer[TRACE_BUFFER];
+static int traceCount = 0;
+#ifdef UMEM_THREADSAFE
+static pthread_mutex_t traceMutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static unsigned long nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int tracing(void) {
+    return __atomic_load_n(&traceFd, __ATOMIC_RELAXED) >= 0;
+}
+
+static void traceLock(void) {
+#ifdef UMEM_THREADSAFE
+    pthread_mutex_lock(&traceMutex);
+#endif
+}
+
+static void traceUnlock(void) {
+#ifdef UMEM_THREADSAFE
+    pthread_mutex_unlock(&traceMutex);
+#endif
+}
+
+// Called with the trace lock held
+static void traceFlush(void) {
+    char *bytes = (char *)traceBuffer;
+    size_t left = traceCount * sizeof(umem_trace_record_t);
+    while (left > 0) {
+        ssize_t written = write(traceFd, bytes, left);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            break;  // Out of disk or closed: drop the rest rather than stall the program
+        }
+        bytes += written;
+        left -= written;
+    }
+    traceCount = 0;
+}
+
+// Called with the trace lock held
+static void traceWrite(int op, size_t size, void *id, void *oldId) {
+    if (traceFd < 0) {
+        return;  // Stopped while this call was running
+    }
+
+    umem_trace_record_t *record = &traceBuffer[traceCount++];
+    record->stamp = ((uint64_t)op << UMEM_TRACE_OP_SHIFT) | ((nowNs() - traceStart) & UMEM_TRACE_TIME_MASK);
+    record->size = size;
+    record->id = (uintptr_t)id;
+    record->oldId = (uintptr_t)oldId;
+    if (traceCount == TRACE_BUFFER) {
+        traceFlush();
+    }
+}
+
+static void traceRecord(int op, size_t size, void *id, void *oldId) {
+    traceLock();
+    traceWrite(op, size, id, oldId);
+    traceUnlock();
+}
+
+static void traceAtExit(void) {
+    umemtrace_stop();
+}
+
+int umemtrace_start(const char *path) {
+    static int exitHook = 0;
+
+    traceLock();
+    if (traceFd >= 0) {
+        traceUnlock();
+        return -1;  // One trace at a time
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || write(fd, TRACE_TAG, 8) != 8) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        traceUnlock();
+        return -1;
+    }
+    if (!exitHook) {
+        atexit(traceAtExit);  // Whatever is still buffered at exit is kept
+        exitHook = 1;
+    }
+
+    traceStart = nowNs();
+    traceCount = 0;
+    __atomic_store_n(&traceFd, fd, __ATOMIC_RELAXED);
+    traceUnlock();
+    return 0;
+}
+
+int umemtrace_stop(void) {
+    traceLock();
+    if (traceFd < 0) {
+        traceUnlock();
+        return -1;
+    }
+    traceFlush();
+    close(traceFd);
+    __atomic_store_n(&traceFd, -1, __ATOMIC_RELAXED);
+    traceUnlock();
+    return 0;
+}
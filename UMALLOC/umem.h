@@ -1,66 +1,292 @@
-#ifndef _UMEM_H
-#define _UMEM_H
-
-#include <stddef.h>
-#include <stdio.h>
-
-#define MAGIC 0xDEADBEEFLL          // Magic number used for detecting memory corruption
-
-#define BEST_FIT 					(1)
-#define WORST_FIT 					(2)
-#define FIRST_FIT 					(3)
-#define NEXT_FIT 					(4)
-#define BUDDY						(5)
-
-//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// structures : Both structures are required and are 64 bit. 
-//              These structures are each 16 bytes in length.
-//
-typedef struct {
-    long size;              // Size of the block
-    long magic;             // Magic number for integrity check
-} header_t;
-
-typedef struct __node_t {
-    long size;              // Size of the free block
-    struct __node_t *next;  // Pointer to the next free block
-} node_t;
-
-//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// function prototypes
-//
-int 	umeminit(size_t sizeOfRegion, int allocationAlgo);
-void 	*umalloc(size_t size);
-void    *urealloc(void *ptr, size_t size);
-int 	ufree(void *ptr);
-void    umemstats(void);
-
-//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-/**
- * Macro: printumemstats
- * 
- * This macro is used to print memory allocation statistics (bytes allocated, 
- * bytes freed, and the number of allocations). The function is implemented 
- * as a macro to avoid multiple definition issues that might arise when included 
- * in multiple .c files, which can happen if we define this in the header file.
- * 
- * Warning:
- * This is a bit of a hack and not generally recommended in larger projects 
- * or production code. Typically, function definitions should go into a .c 
- * file, and only declarations should be in the header. However, to minimize 
- * the number of files and simplify the assignment setup, we're using a macro 
- * here. Note that macros do not offer the same type safety as functions, and 
- * debugging may be more challenging.
- */
-
- #define printumemstats(total_allocations, total_deallocations, allocated_memory, free_memory, fragmentation) \
-    do {                                                                                                   \
-        printf("Memory Allocation Statistics:\n");                                                        \
-        printf("Total Allocations: %d\n", total_allocations);                                             \
-        printf("Total Deallocations: %d\n", total_deallocations);                                         \
-        printf("Currently Allocated Memory: %zu bytes\n", allocated_memory);                              \
-        printf("Currently Free Memory: %zu bytes\n", free_memory);                                        \
-        printf("Memory Fragmentation: %.2f%%\n", fragmentation);                                          \
-    } while(0)
-
+#ifndef _UMEM_H
+#define _UMEM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define MAGIC 0xDEADBEEFLL          // Magic number used for detecting memory corruption
+
+#define BEST_FIT 					(1)
+#define WORST_FIT 					(2)
+#define FIRST_FIT 					(3)
+#define NEXT_FIT 					(4)
+#define BUDDY						(5)
+#define TLSF						(6)
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// structures : Both structures are required and are 64 bit. 
+//              header_t is 16 bytes in length. node_t overlays the header of
+//              a free block, so its prev link lives in the first 8 bytes of
+//              the payload and the block's last 8 bytes hold a copy of its
+//              size (the footer).
+//
+//              Built with -DUMEM_COMPACT_HEADER (umem.c and every file that
+//              includes this header alike), header_t is the size word alone,
+//              8 bytes, with the magic number cut to 16 bits and packed above
+//              the size. The smallest block is then 16 bytes instead of 32.
+//
+#ifdef UMEM_COMPACT_HEADER
+typedef struct {
+    long size;              // Size of the block, block state in the low 3 bits and MAGIC's low half on top
+} header_t;
+#else
+typedef struct {
+    long size;              // Size of the block; the low 3 bits hold block state
+    long magic;             // Magic number for integrity check
+} header_t;
+#endif
+
+typedef struct __node_t {
+    long size;              // Size of the free block
+    struct __node_t *next;  // Pointer to the next free block
+    struct __node_t *prev;  // Pointer to the previous free block
+} node_t;
+
+// umem_stats_t is a snapshot of a heap's counters. Free blocks are counted
+// by payload size in power-of-two classes: class k holds blocks of 2^(k+4)
+// up to 2^(k+5) - 1 bytes, and the last class everything bigger. Blocks
+// parked in fastbins and thread caches are neither allocated nor free here.
+// Under FIRST_FIT and NEXT_FIT, largestFree can come out up to a sixteenth
+// short once the biggest block has been taken.
+#define UMEM_SIZE_CLASSES 32
+
+#define UMEM_PAGES_NORMAL  0                // Base pages only
+#define UMEM_PAGES_THP     1                // Marked MADV_HUGEPAGE for transparent huge pages
+#define UMEM_PAGES_HUGETLB 2                // Mapped with MAP_HUGETLB from the reserved pool
+
+typedef struct {
+    size_t allocations;                     // Successful allocations so far
+    size_t deallocations;                   // Frees so far
+    size_t allocated;                       // Bytes in live blocks, headers included
+    size_t mapped;                          // Bytes mapped for the region, chunks and large blocks
+    size_t released;                        // Bytes given back to the OS with madvise so far
+    size_t freeBytes;                       // Payload bytes in free blocks
+    size_t freeBlocks;                      // Number of free blocks
+    size_t largestFree;                     // Payload bytes in the biggest free block
+    int pageBacking;                        // UMEM_PAGES_*: how the region and chunks are backed
+    size_t freeClasses[UMEM_SIZE_CLASSES];  // Free blocks per size class
+} umem_stats_t;
+
+// umem_trace_record_t is one call in a trace file (see umemtrace_start).
+// The top 8 bits of stamp hold the operation, the rest the nanoseconds since
+// the trace started. Blocks are identified by address; id is 0 when the call
+// returned NULL.
+#define UMEM_TRACE_MALLOC    1
+#define UMEM_TRACE_REALLOC   2
+#define UMEM_TRACE_FREE      3
+#define UMEM_TRACE_OP_SHIFT  56
+#define UMEM_TRACE_TIME_MASK ((1ULL << UMEM_TRACE_OP_SHIFT) - 1)
+
+typedef struct {
+    uint64_t stamp;         // Operation and time
+    uint64_t size;          // Bytes requested, 0 for UMEM_TRACE_FREE
+    uint64_t id;            // Block returned, or freed for UMEM_TRACE_FREE
+    uint64_t oldId;         // UMEM_TRACE_REALLOC: block passed in
+} umem_trace_record_t;
+
+// umem_heap_t is an opaque handle to one heap: a region, its policy and its
+// arenas. umeminit sets up the default heap that umalloc, urealloc, ufree and
+// umemstats use; umem_heap_create makes further, independent heaps.
+typedef struct __umem_heap_t umem_heap_t;
+
+// upool_t is an opaque handle to a pool of fixed-size objects.
+typedef struct __upool_t upool_t;
+
+// uarena_t is an opaque handle to a bump arena for short-lived allocations.
+typedef struct __uarena_t uarena_t;
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// function prototypes
+//
+// Build umem.c with -DUMEM_THREADSAFE (and -pthread) to call umalloc, urealloc,
+// ufree and umemstats from several threads. umeminit must still finish before
+// any other thread uses the heap.
+//
+// umeminit_arenas splits the region into arenaCount equal arenas (at most 64),
+// each with its own free structures and lock. Threads are assigned to arenas
+// round-robin on their first allocation; umeminit is umeminit_arenas with one.
+//
+int 	umeminit(size_t sizeOfRegion, int allocationAlgo);
+int     umeminit_arenas(size_t sizeOfRegion, int allocationAlgo, int arenaCount);
+void 	*umalloc(size_t size);
+void    *urealloc(void *ptr, size_t size);
+int 	ufree(void *ptr);
+void    umemstats(void);
+
+// The same operations on an explicit heap. Each heap has its own region,
+// policy, arenas and statistics; umem_heap_destroy unmaps the whole heap at
+// once, so every pointer from it is invalid afterwards. A pointer must go back
+// to the heap it came from. The default heap cannot be destroyed.
+//
+umem_heap_t *umem_heap_create(size_t sizeOfRegion, int allocationAlgo, int arenaCount);
+int     umem_heap_destroy(umem_heap_t *heap);
+void    *umalloc_from(umem_heap_t *heap, size_t size);
+void    *urealloc_from(umem_heap_t *heap, void *ptr, size_t size);
+int     ufree_to(umem_heap_t *heap, void *ptr);
+void    umemstats_from(umem_heap_t *heap);
+
+// umemsnapshot fills stats from counters that are kept up to date as blocks
+// are split and merged, so it costs the same however big the heap is; use it
+// instead of umemstats to poll a live heap. umemstats_json writes the same
+// snapshot to out as one line of JSON.
+//
+void    umemsnapshot(umem_stats_t *stats);
+void    umemsnapshot_from(umem_heap_t *heap, umem_stats_t *stats);
+void    umemstats_json(FILE *out);
+void    umemstats_json_from(umem_heap_t *heap, FILE *out);
+
+// umemtrace_start logs every umalloc, urealloc and ufree call on the default
+// heap to a binary file at path until umemtrace_stop (or exit), along with
+// the aligned and batch calls: each aligned or batch block as an
+// UMEM_TRACE_MALLOC of its size, each pointer ufree_batch is given as an
+// UMEM_TRACE_FREE. Calls on explicit heaps, pools and arenas are not logged.
+// replay.c runs a trace against each policy. Both return 0 on success and -1
+// otherwise.
+//
+int     umemtrace_start(const char *path);
+int     umemtrace_stop(void);
+
+// Aligned allocation: the payload starts at a multiple of alignment, which
+// must be a power of two. The pointer is freed and resized with ufree and
+// urealloc like any other; urealloc does not keep the alignment.
+// uposix_memalign follows posix_memalign, returning 0, EINVAL or ENOMEM.
+//
+void    *ualigned_alloc(size_t alignment, size_t size);
+void    *ualigned_alloc_from(umem_heap_t *heap, size_t alignment, size_t size);
+int     uposix_memalign(void **memptr, size_t alignment, size_t size);
+
+// umalloc_usable_size returns the bytes the block at ptr can hold, which may
+// be more than were asked for; 0 for NULL.
+//
+size_t  umalloc_usable_size(void *ptr);
+
+// Batch allocation: umalloc_batch stores up to count pointers to blocks of
+// size bytes in out and returns how many it got, fewer only when memory runs
+// out. ufree_batch frees count pointers (NULLs are skipped) and sorts ptrs in
+// the process. Either side may be mixed with umalloc and ufree.
+//
+size_t  umalloc_batch(size_t size, size_t count, void **out);
+size_t  umalloc_batch_from(umem_heap_t *heap, size_t size, size_t count, void **out);
+int     ufree_batch(void **ptrs, size_t count);
+int     ufree_batch_to(umem_heap_t *heap, void **ptrs, size_t count);
+
+// Heap creation with flags; the plain calls pass 0. With UMEM_HUGE_PAGES the
+// region and every chunk the heap grows by are rounded up to 2 MB and backed
+// by huge pages: MAP_HUGETLB when the system has them reserved, otherwise an
+// aligned mapping marked MADV_HUGEPAGE, otherwise base pages. The pageBacking
+// field of umem_stats_t says which one the heap ended up with (the weakest,
+// if its mappings differ).
+//
+#define UMEM_HUGE_PAGES 0x1
+
+int     umeminit_flags(size_t sizeOfRegion, int allocationAlgo, int arenaCount, int flags);
+umem_heap_t *umem_heap_create_flags(size_t sizeOfRegion, int allocationAlgo, int arenaCount, int flags);
+
+// Persistent heaps: umem_heap_open keeps the heap in the file at path, mapped
+// MAP_SHARED. An empty or missing file gets a new heap of sizeOfRegion bytes;
+// a file that already holds one is mapped back at the address it was made at
+// with its blocks and free structures as they were, and the size, policy and
+// arena count come from the file. A new file is placed at a gigabyte boundary
+// between 32 and 64 TB, where programs seldom map anything, so its address is
+// likely free in the next process too (UMEM_FILE_BASE and UMEM_FILE_SPAN in
+// umem.c move the range). Pointers into the heap stay valid across restarts,
+// so data can be reached again from the root pointer saved with
+// umem_heap_set_root. umem_heap_destroy flushes the heap to the file and
+// closes it; umeminit_file does the same at exit for the default heap. The
+// open fails if another process has the file, if the address is taken, or if
+// the last process died without closing it. Nothing repairs a file in the last
+// state, and one whose address is taken in every run of the program never
+// opens either: remove the file (or truncate it to 0 bytes) and open it again
+// to start over with an empty heap, rebuilding the data the slow way. A file
+// heap cannot grow, keeps every block in the file (the mmap threshold stays 0)
+// and bypasses the thread cache.
+//
+int     umeminit_file(const char *path, size_t sizeOfRegion, int allocationAlgo, int arenaCount);
+umem_heap_t *umem_heap_open(const char *path, size_t sizeOfRegion, int allocationAlgo, int arenaCount);
+void    *umemroot(void);
+int     umemsetroot(void *ptr);
+void    *umem_heap_root(umem_heap_t *heap);
+int     umem_heap_set_root(umem_heap_t *heap, void *ptr);
+
+// Let a heap grow: when no arena can satisfy a request, the thread's arena
+// maps another chunk (each twice the size of the last) instead of returning
+// NULL. maxSize caps the total bytes mapped for the heap; 0 means no cap.
+// BUDDY heaps cannot grow. umemgrow applies to the default heap.
+//
+int     umemgrow(size_t maxSize);
+int     umem_heap_grow(umem_heap_t *heap, size_t maxSize);
+
+// Requests of at least threshold bytes (128 KB by default) get a mapping of
+// their own instead of a block in an arena; ufree unmaps it and urealloc
+// resizes it with mremap. 0 sends every request to the arenas.
+//
+int     umemmapthreshold(size_t threshold);
+int     umem_heap_set_mmap_threshold(umem_heap_t *heap, size_t threshold);
+
+// Free blocks of at least threshold bytes (64 KB by default) give their
+// pages back to the OS with madvise once their arena has held them for
+// decayMs milliseconds (1000 by default); a threshold of 0 turns this off.
+// There is no background thread: the deadline is checked when a call next
+// reaches the arena (calls the thread cache answers do not count), so a
+// program that goes idle should call umempurge, which releases every free
+// page right away. umemstats reports the bytes released so far.
+//
+int     umemdecay(size_t threshold, unsigned decayMs);
+int     umem_heap_set_decay(umem_heap_t *heap, size_t threshold, unsigned decayMs);
+void    umempurge(void);
+void    umem_heap_purge(umem_heap_t *heap);
+
+// Object pools: every object of a pool has the same size and no header.
+// Objects are carved from slabs the pool takes from a heap (the default heap
+// for upool_create); upool_free makes an object available to the same pool
+// again, and upool_destroy returns every slab, invalidating all its objects.
+// Objects get no double-free or corruption checks.
+//
+upool_t *upool_create(size_t objectSize);
+upool_t *upool_create_from(umem_heap_t *heap, size_t objectSize);
+void    *upool_alloc(upool_t *pool);
+void    upool_free(upool_t *pool, void *ptr);
+void    upool_destroy(upool_t *pool);
+
+// Bump arenas: uarena_alloc advances a pointer through chunks of chunkSize
+// bytes (64 KB for 0) taken from a heap. There is no per-object free;
+// uarena_reset invalidates everything allocated so far in one call and keeps
+// one chunk for reuse, uarena_destroy returns all of it. An arena is meant for
+// one thread at a time, even in the thread-safe build.
+//
+uarena_t *uarena_create(size_t chunkSize);
+uarena_t *uarena_create_from(umem_heap_t *heap, size_t chunkSize);
+void    *uarena_alloc(uarena_t *arena, size_t size);
+void    uarena_reset(uarena_t *arena);
+void    uarena_destroy(uarena_t *arena);
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+/**
+ * Macro: printumemstats
+ * 
+ * This macro is used to print memory allocation statistics (bytes allocated, 
+ * bytes freed, and the number of allocations). The function is implemented 
+ * as a macro to avoid multiple definition issues that might arise when included 
+ * in multiple .c files, which can happen if we define this in the header file.
+ * 
+ * Warning:
+ * This is a bit of a hack and not generally recommended in larger projects 
+ * or production code. Typically, function definitions should go into a .c 
+ * file, and only declarations should be in the header. However, to minimize 
+ * the number of files and simplify the assignment setup, we're using a macro 
+ * here. Note that macros do not offer the same type safety as functions, and 
+ * debugging may be more challenging.
+ */
+
+ #define printumemstats(total_allocations, total_deallocations, allocated_memory, free_memory, fragmentation) \
+    do {                                                                                                   \
+        printf("Memory Allocation Statistics:\n");                                                        \
+        printf("Total Allocations: %d\n", total_allocations);                                             \
+        printf("Total Deallocations: %d\n", total_deallocations);                                         \
+        printf("Currently Allocated Memory: %zu bytes\n", allocated_memory);                              \
+        printf("Currently Free Memory: %zu bytes\n", free_memory);                                        \
+        printf("Memory Fragmentation: %.2f%%\n", fragmentation);                                          \
+    } while(0)
+
 #endif
\ No newline at end of file